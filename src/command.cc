@@ -33,6 +33,8 @@
 #include "bignum.h"
 #include "decimal.h"
 #include "dmcp.h"
+#include "file.h"
+#include "files.h"
 #include "fraction.h"
 #include "integer.h"
 #include "parser.h"
@@ -58,6 +60,96 @@ RECORDER(command,       16, "RPL Commands");
 RECORDER(command_error, 16, "Errors processing a command");
 
 
+// ============================================================================
+//
+//   Command name index
+//
+// ============================================================================
+//   Command spellings are indexed by a hash of their first two bytes, case
+//   folded the same way strncasecmp does. Single-byte spellings like `+`
+//   are indexed with a zero second byte, so that a lookup only needs to
+//   walk two buckets. Within a bucket, entries keep the order of the
+//   spellings table, so that a lookup finds the same first match as a
+//   linear scan of the whole table.
+
+enum command_index_constants
+// ----------------------------------------------------------------------------
+//   Sizing the index from the same spellings as object::spellings
+// ----------------------------------------------------------------------------
+{
+    COMMAND_BUCKETS     = 256,
+    COMMAND_FIRST       = 0x8000,       // First spelling of a type
+    COMMAND_SPELLINGS   = 0
+#define ALIAS(ty, name)         + 1
+#define ID(ty)                  ALIAS(ty, #ty)
+#define NAMED(ty, name)         ALIAS(ty, name) ALIAS(ty, #ty)
+#include "ids.tbl"
+};
+
+static uint16_t command_index[COMMAND_SPELLINGS];
+static uint16_t command_bucket[COMMAND_BUCKETS + 1];
+
+
+static inline uint command_hash(byte first, byte second)
+// ----------------------------------------------------------------------------
+//   Hash the first two bytes of a command name
+// ----------------------------------------------------------------------------
+{
+    return (tolower(first) * 31 + tolower(second)) % COMMAND_BUCKETS;
+}
+
+
+static void command_index_build()
+// ----------------------------------------------------------------------------
+//   Sort the command spellings into buckets on first use
+// ----------------------------------------------------------------------------
+{
+    static bool built = false;
+    if (built)
+        return;
+
+    // Two passes, first counting bucket sizes, then filling the buckets
+    for (uint pass = 0; pass < 2; pass++)
+    {
+        object::id type = object::id(0);
+        for (size_t i = 0; i < object::spelling_count; i++)
+        {
+            const object::spelling &s = object::spellings[i];
+            if (!object::is_command(s.type))
+                continue;
+            if (cstring cmd = s.name)
+            {
+                bool first = type != s.type;
+                type = s.type;
+                uint hash = command_hash(cmd[0], cmd[0] ? cmd[1] : 0);
+                if (pass)
+                    command_index[command_bucket[hash]++] =
+                        i | (first ? COMMAND_FIRST : 0);
+                else
+                    command_bucket[hash + 1]++;
+            }
+        }
+
+        // After first pass, turn sizes into start positions.
+        // After second pass, start positions have moved to the bucket end.
+        if (pass)
+        {
+            for (uint b = COMMAND_BUCKETS; b > 0; b--)
+                command_bucket[b] = command_bucket[b - 1];
+            command_bucket[0] = 0;
+        }
+        else
+        {
+            for (uint b = 0; b < COMMAND_BUCKETS; b++)
+                command_bucket[b + 1] += command_bucket[b];
+        }
+    }
+    record(command, "Indexed %u command spellings in %u buckets",
+           command_bucket[COMMAND_BUCKETS], COMMAND_BUCKETS);
+    built = true;
+}
+
+
 PARSE_BODY(command)
 // ----------------------------------------------------------------------------
 //    Try to parse this as a command, using either short or long name
@@ -69,43 +161,55 @@ PARSE_BODY(command)
         return SKIP;
 
     bool    eq     = p.precedence;
-    id      type   = id(0);
     id      found  = id(0);
     cstring ref    = cstring(utf8(p.source));
     size_t  maxlen = p.length;
     size_t  len    = maxlen;
 
-    for (size_t i = 0; i < spelling_count; i++)
+    // Merge the buckets for one-byte and longer spellings in table order
+    command_index_build();
+    uint            longer = command_hash(ref[0], maxlen > 1 ? ref[1] : 0);
+    uint            single = command_hash(ref[0], 0);
+    const uint16_t *l      = command_index + command_bucket[longer];
+    const uint16_t *le     = command_index + command_bucket[longer + 1];
+    const uint16_t *s      = command_index + command_bucket[single];
+    const uint16_t *se     = command_index + command_bucket[single + 1];
+    if (single == longer)
+        s = se;
+
+    while (l < le || s < se)
     {
-        if (!is_command(spellings[i].type))
-            continue;
-        if (cstring cmd = spellings[i].name)
-        {
-            if (type != spellings[i].type)
-            {
-                type = spellings[i].type;
+        uint entry;
+        if (s >= se || (l < le && (*l & ~COMMAND_FIRST) <
+                                  (*s & ~COMMAND_FIRST)))
+            entry = *l++;
+        else
+            entry = *s++;
 
-                // When parsing an equation, parse x³ as cubed(x)
-                if (eq && (type == ID_sq || type == ID_cubed || type == ID_inv))
-                    continue;
-            }
+        const spelling &sp    = spellings[entry & ~COMMAND_FIRST];
+        id              type  = sp.type;
+        cstring         cmd   = sp.name;
 
-            // No function names like `min` while parsing units
-            if (unit::mode && is_valid_as_name_initial(utf8(cmd)))
-                continue;
+        // When parsing an equation, parse x³ as cubed(x)
+        if (eq && (entry & COMMAND_FIRST) &&
+            (type == ID_sq || type == ID_cubed || type == ID_inv))
+            continue;
 
-            len = strlen(cmd);
-            if (len <= maxlen
-                && strncasecmp(ref, cmd, len) == 0
-                && (len >= maxlen
-                    || (eq && (!is_valid_as_name_initial(utf8(cmd)) ||
-                               ((ref[len] < '0' || ref[len] > '9') &&
-                                !is_valid_as_name_initial(utf8(ref + len)))))
-                    || is_separator(utf8(ref + len))))
-            {
-                found = type;
-                break;
-            }
+        // No function names like `min` while parsing units
+        if (unit::mode && is_valid_as_name_initial(utf8(cmd)))
+            continue;
+
+        len = strlen(cmd);
+        if (len <= maxlen
+            && strncasecmp(ref, cmd, len) == 0
+            && (len >= maxlen
+                || (eq && (!is_valid_as_name_initial(utf8(cmd)) ||
+                           ((ref[len] < '0' || ref[len] > '9') &&
+                            !is_valid_as_name_initial(utf8(ref + len)))))
+                || is_separator(utf8(ref + len))))
+        {
+            found = type;
+            break;
         }
     }
 
@@ -640,6 +744,90 @@ COMMAND_BODY(SaveState)
 }
 
 
+static bool state_file_arg(char *buf, size_t size)
+// ----------------------------------------------------------------------------
+//   Get the path for a state file given by name in level 1
+// ----------------------------------------------------------------------------
+{
+    if (!rt.args(1))
+        return false;
+    text_p name = rt.top()->as<text>();
+    if (!name)
+    {
+        rt.type_error();
+        return false;
+    }
+
+    files_g disk = files::make("data");
+    text_g  path = disk ? disk->filename(name) : nullptr;
+    if (!path)
+        return false;
+
+    size_t len  = 0;
+    utf8   txt  = path->value(&len);
+    if (len >= size)
+    {
+        rt.file_name_too_long_error();
+        return false;
+    }
+    memcpy(buf, txt, len);
+    buf[len] = 0;
+    return true;
+}
+
+
+COMMAND_BODY(SaveStateAs)
+// ----------------------------------------------------------------------------
+//   Save the system state to a given file, keeping the current state file
+// ----------------------------------------------------------------------------
+{
+    char buf[80];
+    if (!state_file_arg(buf, sizeof(buf)))
+        return ERROR;
+
+    // Saving a state file makes it the one loaded at power on, restore it
+    char    current[128];
+    cstring state = get_reset_state_file();
+    size_t  len   = state ? strlen(state) : 0;
+    bool    keep  = len < sizeof(current);
+    if (keep)
+    {
+        memcpy(current, state, len);
+        current[len] = 0;
+    }
+
+    rt.drop();
+    save_state_file(buf);
+    if (keep)
+        set_reset_state_file(current);
+    if (rt.error())
+        return ERROR;
+    return OK;
+}
+
+
+COMMAND_BODY(MergeState)
+// ----------------------------------------------------------------------------
+//   Merge a state file from disk into the current state
+// ----------------------------------------------------------------------------
+{
+    char buf[80];
+    if (!state_file_arg(buf, sizeof(buf)))
+        return ERROR;
+    if (!file(buf, false).valid())
+    {
+        if (!rt.error())
+            rt.file_not_found_error();
+        return ERROR;
+    }
+
+    rt.drop();
+    if (!merge_state_file(buf))
+        return ERROR;
+    return OK;
+}
+
+
 COMMAND_BODY(SystemSetup)
 // ----------------------------------------------------------------------------
 //   Select the system menu
@@ -141,6 +141,8 @@ COMMAND_DECLARE(Type);          // Return the type of the object
 COMMAND_DECLARE(TypeName);      // Return the type name of the object
 COMMAND_DECLARE(Off);           // Switch the calculator off
 COMMAND_DECLARE(SaveState);     // Save state to disk
+COMMAND_DECLARE(SaveStateAs);   // Save state to a given file
+COMMAND_DECLARE(MergeState);    // Merge state file from disk
 COMMAND_DECLARE(SystemSetup);   // Select the system menu
 COMMAND_DECLARE(ScreenCapture); // Snapshot screen state to a file
 COMMAND_DECLARE(Beep);          // Emit a sound (if enabled)
@@ -42,6 +42,45 @@ RECORDER(decimal, 32, "Variable-precision decimal data type");
 RECORDER(decimal_error, 32, "Variable-precision decimal data type");
 
 
+constexpr small_decimals::small_decimals()
+// ----------------------------------------------------------------------------
+//   Build the table of decimal constants at compile time
+// ----------------------------------------------------------------------------
+//   Each entry holds the LEB128 type, the exponent, the kigit count and
+//   a single 10-bit packed kigit, matching what decimal::decimal() builds
+    : data()
+{
+    for (int i = MIN; i <= MAX + 1; i++)
+    {
+        bool half  = i > MAX;
+        uint type  = i < 0 ? object::ID_neg_decimal : object::ID_decimal;
+        uint value = half ? 5 : i < 0 ? -i : i;
+        int  exp   = half ? -1 : 0;
+        uint kigit = value;
+        uint n     = 0;
+        byte *p    = data[i - MIN];
+        for (uint digits = value; digits; digits /= 10)
+            exp++;
+        while (kigit && kigit < 100)
+            kigit *= 10;
+        do
+        {
+            p[n++] = (type & 0x7F) | (type >= 0x80 ? 0x80 : 0);
+            type >>= 7;
+        } while (type);
+        p[n++] = exp & 0x7F;
+        p[n++] = kigit ? 1 : 0;
+        if (kigit)
+        {
+            p[n++] = kigit >> 2;
+            p[n++] = (kigit & 3) << 6;
+        }
+    }
+}
+
+constexpr small_decimals SmallDecimals;
+
+
 // ============================================================================
 //
 //   Object interface
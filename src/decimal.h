@@ -172,10 +172,17 @@ struct decimal : algebraic
 
 
     template<typename Int>
-    static decimal_p make(Int x, large exp = 0)
+    static decimal_p make(Int x, large exp = 0);
     // ------------------------------------------------------------------------
     //   Build a decimal from a signed integer
     // ------------------------------------------------------------------------
+
+
+    template<typename Int>
+    static decimal_p make_temporary(Int x, large exp = 0)
+    // ------------------------------------------------------------------------
+    //   Build a decimal from a signed integer in temporaries
+    // ------------------------------------------------------------------------
     {
         if (x < 0)
             return rt.make<decimal>(ID_neg_decimal, -x, exp);
@@ -744,4 +751,43 @@ inline bool decimal::is_magnitude_less_than_half() const
     return is_magnitude_less_than(500, 0);
 }
 
+struct small_decimals
+// ----------------------------------------------------------------------------
+//   Read-only table of preallocated common decimal constants
+// ----------------------------------------------------------------------------
+//   This holds small integer values, as well as 0.5
+{
+    enum { MIN = -1, MAX = 10, SIZE = 6, HALF = MAX - MIN + 1, COUNT };
+
+    constexpr small_decimals();
+
+    template <typename Int>
+    decimal_p find(Int value, large exp) const
+    {
+        if (value < 0 ? large(value) < MIN : ularge(value) > MAX)
+            return nullptr;
+        if (exp == 0)
+            return decimal_p(data[large(value) - MIN]);
+        if (exp == -1 && value == 5)
+            return decimal_p(data[HALF]);
+        return nullptr;
+    }
+
+    byte data[COUNT][SIZE];
+};
+
+extern const small_decimals SmallDecimals;
+
+
+template<typename Int>
+decimal_p decimal::make(Int x, large exp)
+// ----------------------------------------------------------------------------
+//   Build a decimal from a signed integer, using constants when possible
+// ----------------------------------------------------------------------------
+{
+    if (decimal_p result = SmallDecimals.find(x, exp))
+        return result;
+    return make_temporary(x, exp);
+}
+
 #endif // DECIMAL_H
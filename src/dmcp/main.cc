@@ -125,6 +125,16 @@ void redraw_lcd(bool force)
 }
 
 
+enum
+// ----------------------------------------------------------------------------
+//   Budget for garbage collection while idle
+// ----------------------------------------------------------------------------
+{
+    IDLE_GC_STEP = 1024,                // Bytes of nursery scanned per step
+    IDLE_GC_TIME = 10,                  // Milliseconds spent per refresh
+};
+
+
 static void redraw_periodics()
 // ----------------------------------------------------------------------------
 //   Redraw the elements that move
@@ -150,6 +160,16 @@ static void redraw_periodics()
     else if (dawdle_time > 10000)       // If inactive for 10 seconds
         period = 3000;                  // Only upate screen every 3 second
 
+    // Collect recent garbage in small steps while the user reads the screen
+    if (dawdle_time > 1000 && rt.nursery())
+    {
+        record(main, "Idle collection of %u bytes", rt.nursery());
+        uint start = sys_current_ms();
+        while (rt.nursery() && key_empty() &&
+               sys_current_ms() - start < IDLE_GC_TIME)
+            rt.gc(true, IDLE_GC_STEP);
+    }
+
     uint then = sys_current_ms();
     record(main, "Dawdling for %u at %u after %u", period, then, then-now);
 
@@ -31,6 +31,8 @@
 
 #include "dmcp.h"
 #include "file.h"
+#include "files.h"
+#include "list.h"
 #include "main.h"
 #include "object.h"
 #include "program.h"
@@ -38,12 +40,14 @@
 #include "runtime.h"
 #include "settings.h"
 #include "target.h"
+#include "text.h"
 #include "types.h"
 #include "user_interface.h"
 #include "util.h"
 #include "variables.h"
 
 #include <cstdio>
+#include <cstring>
 
 
 // ============================================================================
@@ -208,6 +212,261 @@ const smenu_t state_menu =
 };
 
 
+// ============================================================================
+//
+//   Binary state snapshots
+//
+// ============================================================================
+//   A binary snapshot is saved next to each text state file, with a .48B
+//   extension. It holds the raw bytes of the settings, the home directory,
+//   the stack and the current path, so that loading it is mostly a bulk read.
+//   Objects do not contain pointers, so only stack levels need relocation.
+//   A full save starts the text state file with a comment holding a stamp,
+//   which the snapshot records along with the size of the text file.
+//   A snapshot is only used if it was saved with the same IDs, and if the
+//   text file still has the same size and stamp, which only requires reading
+//   its first line. Editing the text file usually changes its size, and
+//   saving it from the calculator changes the stamp or removes the snapshot.
+//   Otherwise, we fall back to parsing the text state file.
+
+enum { STATE_PATH_MAX = 128, STATE_STAMP_DIGITS = 8 };
+static const char StateStamp[] = " DB48X state ";
+
+
+static inline uint32_t state_hash_bytes(uint32_t hash, byte_p p, size_t sz)
+// ----------------------------------------------------------------------------
+//   Add bytes to a FNV-1a hash
+// ----------------------------------------------------------------------------
+{
+    while (sz--)
+        hash = (hash ^ *p++) * 16777619U;
+    return hash;
+}
+
+
+static uint32_t state_stamp()
+// ----------------------------------------------------------------------------
+//   Compute a stamp that identifies a full save
+// ----------------------------------------------------------------------------
+{
+    directory_p home = rt.homedir();
+    uint32_t    now  = sys_current_ms();
+    uint32_t    hash = state_hash_bytes(2166136261U,
+                                        byte_p(home), home->size());
+    return state_hash_bytes(hash, byte_p(&now), sizeof(now));
+}
+
+
+static bool state_read_stamp(file &text, uint32_t &stamp)
+// ----------------------------------------------------------------------------
+//   Read the stamp in the first line of a text state file, then rewind it
+// ----------------------------------------------------------------------------
+{
+    const size_t hlen = sizeof(StateStamp) - 1;
+    char         buf[1 + hlen + STATE_STAMP_DIGITS];
+    text.seek(0);
+    bool ok = text.read(buf, sizeof(buf))       &&
+        buf[0] == '@'                           &&
+        memcmp(buf + 1, StateStamp, hlen) == 0;
+    text.seek(0);
+
+    stamp = 0;
+    for (uint i = 1 + hlen; ok && i < sizeof(buf); i++)
+    {
+        char c = buf[i];
+        uint digit = c >= '0' && c <= '9' ? c - '0'
+                   : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                   : 16;
+        ok = digit < 16;
+        stamp = stamp * 16 + digit;
+    }
+    return ok;
+}
+
+
+static bool state_snapshot_path(char *snap, cstring path)
+// ----------------------------------------------------------------------------
+//   Build the name of the binary snapshot for a given text state file
+// ----------------------------------------------------------------------------
+{
+    size_t len = strlen(path);
+    if (len < 4 || len >= STATE_PATH_MAX || strcasecmp(path+len-4, ".48S"))
+        return false;
+    memcpy(snap, path, len + 1);
+    snap[len - 1] = path[len - 1] == 's' ? 'b' : 'B';
+    return true;
+}
+
+
+static void state_save_snapshot(cstring path, const settings &saved,
+                                uint32_t stamp, uint32_t textsize)
+// ----------------------------------------------------------------------------
+//   Save a binary snapshot of the state
+// ----------------------------------------------------------------------------
+//   The stamp and size are those of the text state file that was just saved
+{
+    char snap[STATE_PATH_MAX];
+    if (!state_snapshot_path(snap, path))
+        return;
+
+    byte        magic[]  = FILE_MAGIC;
+    uint32_t    checksum = files::id_checksum();
+    uint32_t    setsize  = sizeof(saved);
+    directory_p home     = rt.homedir();
+    uint32_t    homesize = home->size();
+    uint32_t    depth    = rt.depth();
+    list_g      cwd      = directory::path(object::ID_block);
+
+    file f(snap, true);
+    bool ok = f.valid()                                         &&
+        f.write(cstring(magic), sizeof(magic))                  &&
+        f.write(cstring(&checksum), sizeof(checksum))           &&
+        f.write(cstring(&stamp), sizeof(stamp))                 &&
+        f.write(cstring(&textsize), sizeof(textsize))           &&
+        f.write(cstring(&setsize), sizeof(setsize))             &&
+        f.write(cstring(&saved), setsize)                       &&
+        f.write(cstring(&homesize), sizeof(homesize))           &&
+        f.write(cstring(home), homesize)                        &&
+        f.write(cstring(&depth), sizeof(depth));
+    for (uint level = depth; ok && level > 0; level--)
+    {
+        object_p obj = rt.stack(level - 1);
+        ok = f.write(cstring(obj), obj->size());
+    }
+    if (ok && cwd)
+        ok = f.write(cstring(+cwd), cwd->size());
+
+    // Do not leave a partial snapshot behind
+    if (!ok)
+    {
+        f.close();
+        file::unlink(snap);
+    }
+}
+
+
+static bool state_load_snapshot(cstring path, file &text)
+// ----------------------------------------------------------------------------
+//   Load a binary snapshot if there is a valid one for the state file
+// ----------------------------------------------------------------------------
+//   This is only done when the state is empty, i.e. not when merging
+{
+    char snap[STATE_PATH_MAX];
+    if (!state_snapshot_path(snap, path))
+        return false;
+    if (rt.depth() || rt.directories() != 1 || rt.homedir()->count())
+        return false;
+    if (rt.allocated())
+        return false;
+
+    file f;
+    f.open(snap);
+    if (!f.valid())
+        return false;
+
+    byte     magic[]  = FILE_MAGIC;
+    byte     fmagic[sizeof(magic)];
+    uint32_t checksum  = 0;
+    uint32_t stamp     = 0;
+    uint32_t textsize  = 0;
+    uint32_t textstamp = 0;
+    uint32_t setsize   = 0;
+    uint32_t homesize  = 0;
+    uint32_t depth     = 0;
+    settings loaded;
+    if (!f.read((char *) fmagic, sizeof(fmagic))                   ||
+        memcmp(fmagic, magic, sizeof(magic)) != 0                   ||
+        !f.read((char *) &checksum, sizeof(checksum))               ||
+        checksum != files::id_checksum()                            ||
+        !f.read((char *) &stamp, sizeof(stamp))                     ||
+        !f.read((char *) &textsize, sizeof(textsize))               ||
+        textsize != text.size()                                     ||
+        !state_read_stamp(text, textstamp)                          ||
+        textstamp != stamp                                          ||
+        !f.read((char *) &setsize, sizeof(setsize))                 ||
+        setsize != sizeof(loaded)                                   ||
+        !f.read((char *) &loaded, setsize)                          ||
+        !f.read((char *) &homesize, sizeof(homesize)))
+        return false;
+
+    // Read the home directory directly in place
+    byte *home = rt.home_image(homesize);
+    if (!home)
+    {
+        rt.clear_error();
+        return false;
+    }
+    object_p dir = object_p(home);
+    if (!f.read((char *) home, homesize)                            ||
+        dir->type() != object::ID_directory                         ||
+        dir->size() != homesize                                     ||
+        !f.read((char *) &depth, sizeof(depth)))
+    {
+        rt.reset();
+        return false;
+    }
+    runtime::directories_changed();
+
+    // Read stack levels and path into the scratchpad, in large chunks
+    {
+        scribble scr;
+        while (true)
+        {
+            size_t room = 1024;
+            byte  *ptr  = rt.reserve(room);
+            size_t read = room ? f.read_some((char *) ptr, room) : 0;
+            if (!read)
+                break;
+            rt.allocate(read);
+        }
+
+        // Check that we have the expected objects before using them
+        byte_p start = scr.scratch();
+        byte_p end   = start + scr.growth();
+        uint   count = 0;
+        bool   valid = true;
+        for (byte_p p = start; valid && p < end; count++)
+        {
+            object_p obj = object_p(p);
+            size_t   sz  = obj->type() < object::NUM_IDS ? obj->size() : 0;
+            valid = sz && p + sz <= end;
+            p += sz;
+        }
+        if (!valid || count < depth || count > depth + 1)
+        {
+            rt.reset();
+            return false;
+        }
+
+        // Turn the scratchpad into temporaries and push the stack levels
+        object_g obj = rt.temporary();
+        for (uint level = 0; level < depth; level++)
+        {
+            if (!rt.push(obj))
+            {
+                rt.reset();
+                rt.clear_error();
+                return false;
+            }
+            obj = obj->skip();
+        }
+
+        // Restore the settings, then enter the current directory
+        settings previous = Settings;
+        Settings = loaded;
+        if (count > depth && program::run(+obj) != object::OK)
+        {
+            Settings = previous;
+            rt.reset();
+            rt.clear_error();
+            return false;
+        }
+    }
+    rt.clone_stack();
+    return true;
+}
+
+
 static bool state_save_variable(object_p name, object_p obj, void *renderer_ptr)
 // ----------------------------------------------------------------------------
 //   Emit Object 'Name' STO for each object in the top level directory
@@ -226,30 +485,12 @@ static bool state_save_variable(object_p name, object_p obj, void *renderer_ptr)
 }
 
 
-static int state_save_callback(cstring fpath, cstring fname, void *)
+static void state_save_settings()
 // ----------------------------------------------------------------------------
-//   Callback when a file is selected
+//   Select the settings used to render a state file
 // ----------------------------------------------------------------------------
+//   See also what depends on "raw" (r.file_save()) in renderers
 {
-    // Display the name of the file being saved
-    ui.draw_message("Saving state...", fname);
-
-    // Store the state file name so that we automatically reload it
-    set_reset_state_file(fpath);
-
-    // Open save file name
-    file prog(fpath, true);
-    if (!prog.valid())
-    {
-        disp_disk_info("State save failed");
-        wait_for_key_press();
-        return 1;
-    }
-
-    // Always render things to disk using default settings
-    // See also what depends on "raw" (r.file_save()) in renderers
-    renderer render(prog);
-    settings saved = Settings;
     Settings = settings();
     Settings.FancyExponent(false);
     Settings.StandardExponent(1);
@@ -258,11 +499,14 @@ static int state_save_callback(cstring fpath, cstring fname, void *)
     Settings.FractionSpacing(0);
     Settings.DisplayDigits(DB48X_MAXDIGITS);
     Settings.MinimumSignificantDigits(DB48X_MAXDIGITS);
+}
 
-    // Save global variables
-    gcp<directory> home = rt.homedir();
-    home->enumerate(state_save_variable, &render);
 
+static void state_save_tail(renderer &render, const settings &saved, bool all)
+// ----------------------------------------------------------------------------
+//   Save the stack, the settings and the current path
+// ----------------------------------------------------------------------------
+{
     // Save the stack
     uint depth = rt.depth();
     while (depth > 0)
@@ -274,7 +518,8 @@ static int state_save_callback(cstring fpath, cstring fname, void *)
     }
 
     // Save current settings
-    saved.save(render);
+    settings current = saved;
+    current.save(render, all);
 
     // Write the current path
     if (list_p path = directory::path(object::ID_block))
@@ -282,10 +527,273 @@ static int state_save_callback(cstring fpath, cstring fname, void *)
         path->render(render);
         render.put('\n');
     }
+}
+
+
+
+// ============================================================================
+//
+//   Incremental state saving
+//
+// ============================================================================
+//   After saving or loading a state file, we remember a hash of each global
+//   variable. The next save to the same file only appends the variables that
+//   changed or were purged, followed by the stack, settings and path. Since
+//   a state file is run in order when loading, this gives the same result
+//   as a full save. After a number of incremental saves, or if the file grew
+//   too much, a full save compacts the file again.
+//   Hashes are kept in a fixed table of STATE_TRACKED entries, so that they
+//   cost no memory in the runtime area. If the home directory holds more
+//   variables than that, every save is a full save.
+//   Each incremental save starts with a marker comment. Purging variables or
+//   clearing the stack is only safe when loading into an empty state, so
+//   merging a state file into a non-empty state stops at the first marker,
+//   giving the state as of the last full save.
+
+enum
+{
+    STATE_TRACKED       = 64,   // Maximum number of variables we track
+    STATE_DELTAS        = 16,   // Incremental saves before compaction
+};
+
+struct state_hash
+// ----------------------------------------------------------------------------
+//   The hash of a variable at the last save
+// ----------------------------------------------------------------------------
+{
+    uint32_t    name;           // Hash of the variable name
+    uint32_t    value;          // Hash of the variable value
+};
+
+static state_hash StateHashes[STATE_TRACKED];
+static uint       StateCount    = 0;    // Number of variables tracked
+static uint       StateDeltas   = 0;    // Incremental saves since full save
+static uint32_t   StateSize     = 0;    // Size of the file after last save
+static uint32_t   StateFullSize = 0;    // Size of the file after full save
+static bool       StateValid    = false;
+static char       StatePath[STATE_PATH_MAX];
+static const char StateJournal[] = " Changes since last save";
+
+
+static list_g &state_names()
+// ----------------------------------------------------------------------------
+//   The names of tracked variables, in the order of StateHashes
+// ----------------------------------------------------------------------------
+{
+    static list_g names = nullptr;
+    return names;
+}
+
+
+static uint32_t state_hash_object(object_p obj)
+// ----------------------------------------------------------------------------
+//   Compute the FNV-1a hash of the bytes of an object
+// ----------------------------------------------------------------------------
+{
+    return state_hash_bytes(2166136261U, byte_p(obj), obj->size());
+}
+
+
+static bool state_track_variable(object_p name, object_p obj, void *)
+// ----------------------------------------------------------------------------
+//   Record the hash and name of a variable
+// ----------------------------------------------------------------------------
+{
+    if (StateCount >= STATE_TRACKED)
+        return false;
+    StateHashes[StateCount].name  = state_hash_object(name);
+    StateHashes[StateCount].value = state_hash_object(obj);
+    StateCount++;
+    return rt.append(name->size(), byte_p(name)) != nullptr;
+}
+
+
+static void state_untrack()
+// ----------------------------------------------------------------------------
+//   Forget tracked variables, e.g. before the runtime is reset
+// ----------------------------------------------------------------------------
+{
+    StateValid = false;
+    StateCount = 0;
+    state_names() = nullptr;
+}
+
+
+static void state_track(cstring path, uint32_t size, uint deltas)
+// ----------------------------------------------------------------------------
+//   Remember the variables as saved in the given state file
+// ----------------------------------------------------------------------------
+{
+    state_untrack();
+    if (strlen(path) >= STATE_PATH_MAX)
+        return;
+
+    scribble       scr;
+    directory_p    home  = rt.homedir();
+    size_t         count = home->count();
+    if (count > STATE_TRACKED ||
+        home->enumerate(state_track_variable, nullptr) != count)
+        return;
+    state_names() = list::make(scr.scratch(), scr.growth());
+    if (!state_names())
+    {
+        rt.clear_error();
+        return;
+    }
+
+    strcpy(StatePath, path);
+    StateSize = size;
+    if (!deltas)
+        StateFullSize = size;
+    StateDeltas = deltas;
+    StateValid = true;
+}
+
+
+struct state_delta
+// ----------------------------------------------------------------------------
+//   Information used while saving an incremental state
+// ----------------------------------------------------------------------------
+{
+    renderer   *render;                 // Where we write changes
+    bool        seen[STATE_TRACKED];    // Variables still present
+};
+
+
+static bool state_save_changed(object_p name, object_p obj, void *arg)
+// ----------------------------------------------------------------------------
+//   Save a variable if it was added or changed since the last save
+// ----------------------------------------------------------------------------
+{
+    state_delta &delta = *((state_delta *) arg);
+    uint32_t     nhash = state_hash_object(name);
+    uint         i     = 0;
+    for (object_p tracked : *state_names())
+    {
+        if (i < StateCount &&
+            StateHashes[i].name == nhash && tracked->is_same_as(name))
+        {
+            delta.seen[i] = true;
+            if (StateHashes[i].value == state_hash_object(obj))
+                return false;
+            break;
+        }
+        i++;
+    }
+    return state_save_variable(name, obj, delta.render);
+}
+
+
+static bool state_save_delta(cstring path)
+// ----------------------------------------------------------------------------
+//   Append the changes since the last save to the state file
+// ----------------------------------------------------------------------------
+{
+    if (!StateValid || strcmp(path, StatePath) != 0 ||
+        StateDeltas >= STATE_DELTAS || StateSize > 2 * StateFullSize ||
+        rt.homedir()->count() > STATE_TRACKED)
+        return false;
+
+    file prog;
+    prog.open_for_appending(path);
+    if (!prog.valid() || prog.size() != StateSize)
+        return false;
+
+    // Render with the same settings as a full save, starting from home
+    renderer render(prog);
+    settings saved = Settings;
+    state_save_settings();
+    render.put("\n@");
+    render.put(StateJournal);
+    render.put("\nHome\n");
+
+    // Save variables that changed, then purge those that are gone
+    state_delta delta;
+    delta.render = &render;
+    for (uint i = 0; i < StateCount; i++)
+        delta.seen[i] = false;
+    gcp<directory> home = rt.homedir();
+    home->enumerate(state_save_changed, &delta);
+
+    uint i = 0;
+    for (object_p name : *state_names())
+    {
+        if (i < StateCount && !delta.seen[i])
+        {
+            render.put('\'');
+            name->render(render);
+            render.put("' Purge\n");
+        }
+        i++;
+    }
+
+    // Replace the stack, and save all settings and the path
+    render.put("Clear\n");
+    state_save_tail(render, saved, true);
+    Settings = saved;
+
+    // Only full saves write a snapshot, so remove the one that is now stale
+    uint32_t size = prog.position();
+    prog.close();
+    char snap[STATE_PATH_MAX];
+    if (state_snapshot_path(snap, path))
+        file::unlink(snap);
+    state_track(path, size, StateDeltas + 1);
+    return true;
+}
+
+
+static int state_save_callback(cstring fpath, cstring fname, void *)
+// ----------------------------------------------------------------------------
+//   Callback when a file is selected
+// ----------------------------------------------------------------------------
+{
+    // Display the name of the file being saved
+    ui.draw_message("Saving state...", fname);
+
+    // Store the state file name so that we automatically reload it
+    set_reset_state_file(fpath);
+
+    // Only append what changed since the last save if we can
+    if (state_save_delta(fpath))
+        return MRET_EXIT;
+
+    // Open save file name
+    file prog(fpath, true);
+    if (!prog.valid())
+    {
+        disp_disk_info("State save failed");
+        wait_for_key_press();
+        return 1;
+    }
+
+    // Always render things to disk using default settings
+    renderer render(prog);
+    settings saved = Settings;
+    state_save_settings();
+
+    // Stamp the file so that the binary snapshot can be checked quickly
+    uint32_t stamp = state_stamp();
+    render.put('@');
+    render.put(StateStamp);
+    render.printf("%08X\n", uint(stamp));
+
+    // Save global variables
+    gcp<directory> home = rt.homedir();
+    home->enumerate(state_save_variable, &render);
+
+    // Save the stack, settings and path
+    state_save_tail(render, saved, false);
 
     // Restore the settings we had
     Settings = saved;
 
+    // Save a binary snapshot for faster loading, track later changes
+    uint32_t size = prog.position();
+    prog.close();
+    state_save_snapshot(fpath, saved, stamp, size);
+    state_track(fpath, size, 0);
+
     return MRET_EXIT;
 }
 
@@ -342,11 +850,82 @@ static bool danger_will_robinson(cstring header,
 }
 
 
-static int state_load_callback(cstring path, cstring name, void *merge)
+enum { STATE_LOAD_CHUNK = 1024 };
+
+
+static bool state_load_read(file &prog, text_g &buffer, size_t &done,
+                            size_t want, bool &more)
+// ----------------------------------------------------------------------------
+//   Keep the unprocessed part of the buffer and append more of the file
+// ----------------------------------------------------------------------------
+//   Sets 'more' to false at end of file, or at the first NUL character.
+//   Sequences such as -> or << are converted like on the command line.
+//   The unprocessed part starts after a complete line and is converted
+//   again with the new data, so a sequence split across reads is found.
+//   Returns false with an error set if we ran out of memory.
+{
+    {
+        scribble scr;
+        size_t   len = 0;
+        if (buffer)
+        {
+            gcutf8 txt = buffer->value(&len);
+            if (len > done && !rt.append(len - done, txt + done))
+                return false;
+        }
+
+        size_t avail = want;
+        byte  *chunk = rt.reserve(avail);
+        if (!avail)
+        {
+            rt.out_of_memory_error();
+            return false;
+        }
+        size_t got = prog.read_some((char *) chunk, avail);
+        if (byte *nul = (byte *) memchr(chunk, 0, got))
+        {
+            got = nul - chunk;
+            more = false;
+        }
+        else if (!got)
+        {
+            more = false;
+        }
+        rt.allocate(got);
+
+        buffer = text::make(scr.scratch(), scr.growth());
+    }
+    if (buffer)
+        buffer = buffer->import();
+    done = 0;
+    return buffer;
+}
+
+
+enum state_load_mode
+// ----------------------------------------------------------------------------
+//   How a state file is loaded, passed as the callback user data
+// ----------------------------------------------------------------------------
+{
+    STATE_LOAD,                 // Replace the state, after confirmation
+    STATE_MERGE,                // Merge into the current state
+    STATE_BOOT,                 // Load into the empty state at power on
+};
+
+
+static int state_load_callback(cstring path, cstring name, void *data)
 // ----------------------------------------------------------------------------
 //   Callback when a file is selected for loading
 // ----------------------------------------------------------------------------
+//   The file is read in chunks, and objects are parsed and run one at a time,
+//   so that memory usage depends on the largest object, not on the file size.
+//   Objects are only parsed from complete lines, and an unterminated object
+//   is retried with more input until we reach the end of file. Other syntax
+//   errors are reported immediately.
+//   Incremental changes are skipped when merging into a non-empty state.
 {
+    state_load_mode mode  = state_load_mode(uintptr_t(data));
+    bool            merge = mode != STATE_LOAD;
     if (!merge)
     {
         // Check before erasing state
@@ -360,6 +939,7 @@ static int state_load_callback(cstring path, cstring name, void *merge)
             return 0;
 
         // Clear the state
+        state_untrack();
         rt.reset();
         Settings = settings();
 
@@ -381,73 +961,125 @@ static int state_load_callback(cstring path, cstring name, void *merge)
         return 1;
     }
 
-    // Loop on the input file and process it as if it was being typed
-    size_t bytes = 0;
-    rt.clear();
+    // Only track changes for incremental saves if we load into empty state
+    bool track = !rt.depth() && !rt.homedir()->count();
+    bool skip  = mode == STATE_MERGE && !track;
+    state_untrack();
 
-    for (unicode c = prog.get(); c; c = prog.get())
+    // Use the binary snapshot if there is a valid one
+    if (state_load_snapshot(path, prog))
     {
-        byte buffer[4];
-        size_t count = utf8_encode(c, buffer);
-        rt.insert(bytes, buffer, count);
-        bytes += count;
+        state_track(path, prog.size(), 0);
+        return MRET_EXIT;
     }
 
-    // End of file: execute the command we typed
-    size_t edlen = rt.editing();
-    if (edlen)
+    // Loop on the input file, parsing and running one object at a time
+    text_g buffer       = nullptr;
+    size_t done         = 0;
+    size_t ready        = 0;
+    size_t want         = STATE_LOAD_CHUNK;
+    bool   more         = true;
+    bool   store_at_end = Settings.StoreAtEnd();
+    Settings.StoreAtEnd(true);
+    rt.clear();
+
+    while (true)
     {
-        text_g edstr = rt.close_editor(true, false);
-        if (edstr)
+        size_t len = 0;
+        utf8   txt = buffer ? buffer->value(&len) : nullptr;
+        while (done < ready && (txt[done] == ' '  || txt[done] == '\n' ||
+                                txt[done] == '\t' || txt[done] == '\r'))
+            done++;
+
+        // Read more data if we don't have a complete line to parse
+        if (done >= ready)
         {
-            // Need to re-fetch editor length after text conversion
-            gcutf8 editor = edstr->value(&edlen);
-            bool dc = Settings.DecimalComma();
-            Settings.DecimalComma(false);
-            bool store_at_end = Settings.StoreAtEnd();
-            Settings.StoreAtEnd(true);
-            program_g cmds = program::parse(editor, edlen);
-            Settings.DecimalComma(dc);
-            if (cmds)
+            if (!more)
+                break;
+            if (!state_load_read(prog, buffer, done, want, more))
             {
-                // We successfully parsed the line
-                rt.clear();
-                object::result exec = cmds->run();
                 Settings.StoreAtEnd(store_at_end);
-                if (exec != object::OK)
-                {
-                    ui.draw_error();
-                    refresh_dirty();
-                    return 1;
-                }
-
-                // Clone all objects on the stack so that we can purge
-                // the command-line above.
-                rt.clone_stack();
+                if (!rt.error())
+                    rt.out_of_memory_error();
+                ui.draw_error();
+                refresh_dirty();
+                return 1;
             }
-            else
+            txt = buffer->value(&len);
+            ready = len;
+            if (more)
+                while (ready > 0 && txt[ready - 1] != '\n')
+                    ready--;
+            continue;
+        }
+
+        // Parse one object, always using the decimal dot
+        size_t   objlen = ready - done;
+        bool     dc     = Settings.DecimalComma();
+        Settings.DecimalComma(false);
+        object_g obj    = object::parse(txt + done, objlen);
+        Settings.DecimalComma(dc);
+        if (!obj)
+        {
+            // An unterminated object may span beyond the lines we have
+            utf8 err = rt.error();
+            if (more && err && strcmp(cstring(err), "Unterminated") == 0)
             {
-                utf8 pos = rt.source();
-                utf8 ed = editor;
+                rt.clear_error();
+                if (want < 2 * (len - done))
+                    want = 2 * (len - done);
+                ready = done;
+                continue;
+            }
 
-                Settings.StoreAtEnd(store_at_end);
-                if (!rt.error())
-                    rt.syntax_error();
-                beep(3300, 100);
-                if (pos >= editor && pos <= ed + edlen)
-                    ui.cursor_position(pos - ed);
-                if (!rt.edit(ed, edlen))
-                    ui.cursor_position(0);
+            // Show the rest of the file in the editor at the error position
+            txt = buffer->value(&len);
+            utf8   pos   = rt.source();
+            utf8   ed    = txt + done;
+            size_t edlen = len - done;
+
+            Settings.StoreAtEnd(store_at_end);
+            if (!rt.error())
+                rt.syntax_error();
+            beep(3300, 100);
+            if (pos >= ed && pos <= ed + edlen)
+                ui.cursor_position(pos - ed);
+            if (!rt.edit(ed, edlen))
+                ui.cursor_position(0);
+            return 1;
+        }
+        done += objlen;
+        want = STATE_LOAD_CHUNK;
 
-                return 1;
-            }
+        // When merging, do not run incremental saves, which may purge
+        if (skip && obj->type() == object::ID_comment)
+        {
+            size_t clen = 0;
+            utf8   ctxt = text_p(+obj)->value(&clen);
+            size_t jlen = sizeof(StateJournal) - 1;
+            if (clen >= jlen && memcmp(ctxt, StateJournal, jlen) == 0)
+                break;
         }
-        else
+
+        // Run the object as a one-instruction program
+        program_g cmds = program_p(list::make(object::ID_program,
+                                              (byte *) +obj,
+                                              obj->size()));
+        object::result exec = cmds ? cmds->run() : object::ERROR;
+        if (exec != object::OK)
         {
-            rt.out_of_memory_error();
+            Settings.StoreAtEnd(store_at_end);
+            ui.draw_error();
+            refresh_dirty();
             return 1;
         }
     }
+    Settings.StoreAtEnd(store_at_end);
+
+    // Clone all objects on the stack so that we can purge the loaded text
+    rt.clone_stack();
+    if (track)
+        state_track(path, prog.size(), 0);
 
     // Exit with success
     return MRET_EXIT;
@@ -461,7 +1093,7 @@ static int state_load(bool merge)
 {
     bool display_new = false;
     bool overwrite_check = false;
-    void *user_data = (void *) merge;
+    void *user_data = (void *) (merge ? STATE_MERGE : STATE_LOAD);
     int ret = file_selection_screen(merge ? "Merge state" : "Load state",
                                     "/STATE", ".48S",
                                     state_load_callback,
@@ -537,7 +1169,20 @@ bool load_state_file(cstring path)
     for (cstring p = path; *p; p++)
         if (*p == '/' || *p == '\\')
             name = p + 1;
-    return state_load_callback(path, name, (void *) 1) == 0;
+    return state_load_callback(path, name, (void *) STATE_BOOT) == 0;
+}
+
+
+bool merge_state_file(cstring path)
+// ----------------------------------------------------------------------------
+//   Merge the given state file into the current state
+// ----------------------------------------------------------------------------
+{
+    cstring name = path;
+    for (cstring p = path; *p; p++)
+        if (*p == '/' || *p == '\\')
+            name = p + 1;
+    return state_load_callback(path, name, (void *) STATE_MERGE) == MRET_EXIT;
 }
 
 
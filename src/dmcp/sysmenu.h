@@ -72,6 +72,7 @@ int                   menu_item_run(uint8_t mid);
 cstring               menu_item_description(uint8_t mid, char *, const int);
 cstring               state_name();
 bool                  load_state_file(cstring path);
+bool                  merge_state_file(cstring path);
 bool                  save_state_file(cstring path);
 bool                  load_system_state();
 bool                  save_system_state();
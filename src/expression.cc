@@ -661,6 +661,7 @@ expression_p expression::rewrite(expression_r from, expression_r to) const
     uint       rewrites = Settings.MaxRewrites();
 
     // Loop while there are replacements found
+    // All exits go through err, to drop the locals pushed by check_match()
     do
     {
         // Location of expanded equation
@@ -719,7 +720,10 @@ expression_p expression::rewrite(expression_r from, expression_r to) const
                     // Copy from source equation directly
                     object_p obj = *it;
                     if (!rt.append(obj->size(), byte_p(obj)))
-                        return nullptr;
+                    {
+                        eq = nullptr;
+                        goto err;
+                    }
                 }
                 else if (!replaced)
                 {
@@ -753,7 +757,10 @@ expression_p expression::rewrite(expression_r from, expression_r to) const
                         if (expression_p teq = tobj->as<expression>())
                             tobj = teq->objects(&tobjsize);
                         if (!rt.append(tobjsize, byte_p(tobj)))
-                            return nullptr;
+                        {
+                            eq = nullptr;
+                            goto err;
+                        }
                     }
 
                     replaced = true;
@@ -179,6 +179,32 @@ void file::open_for_writing(cstring path)
 }
 
 
+void file::open_for_appending(cstring path)
+// ----------------------------------------------------------------------------
+//    Open a file for writing at the end of existing data
+// ----------------------------------------------------------------------------
+{
+#if SIMULATOR
+    data = fopen(path, "a");
+    if (!data)
+    {
+        record(file_error, "Error %s opening %s for appending",
+               strerror(errno), path);
+        return;
+    }
+#else
+    sys_disk_write_enable(1);
+    FRESULT ok = f_open(&data, path, FA_WRITE | FA_OPEN_APPEND);
+    data.err = ok;
+    if (ok != FR_OK)
+    {
+        sys_disk_write_enable(0);
+        data.flag = 0;
+    }
+#endif                          // SIMULATOR
+}
+
+
 void file::close()
 // ----------------------------------------------------------------------------
 //    Close the help file
@@ -257,6 +283,22 @@ bool file::read(char *buf, size_t len)
 }
 
 
+size_t file::read_some(char *buf, size_t len)
+// ----------------------------------------------------------------------------
+//   Read up to len bytes from a file, return the number of bytes read
+// ----------------------------------------------------------------------------
+{
+#if SIMULATOR
+    return fread(buf, 1, len, data);
+#else
+    UINT bw = 0;
+    if (f_read(&data, buf, len, &bw) != FR_OK)
+        return 0;
+    return bw;
+#endif
+}
+
+
 char file::getchar()
 // ----------------------------------------------------------------------------
 //   Read char code at offset
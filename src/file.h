@@ -51,6 +51,7 @@ struct file
 
     void    open(cstring path);
     void    open_for_writing(cstring path);
+    void    open_for_appending(cstring path);
     bool    valid();
     bool    eof();
     void    close();
@@ -58,12 +59,14 @@ struct file
     bool    put(char c);
     bool    write(const char *buf, size_t len);
     bool    read(char *buf, size_t len);
+    size_t  read_some(char *buf, size_t len);
     unicode get();
     unicode get(uint offset);
     char    getchar();
     void    seek(uint offset);
     unicode peek();
     uint    position();
+    uint    size();
     uint    find(unicode cp);
     uint    rfind(unicode cp);
     cstring error(int err) const;
@@ -158,6 +161,23 @@ inline uint file::position()
 }
 
 
+inline uint file::size()
+// ----------------------------------------------------------------------------
+//   Return the size of the file
+// ----------------------------------------------------------------------------
+{
+#if SIMULATOR
+    uint off    = ftell(data);
+    fseek(data, 0, SEEK_END);
+    uint result = ftell(data);
+    seek(off);
+    return result;
+#else
+    return f_size(&data);
+#endif
+}
+
+
 inline bool file::eof()
 // ----------------------------------------------------------------------------
 //   Indicate if end of file
@@ -101,7 +101,7 @@ static uint32_t computed_checksum = 0;
 static byte     file_magic[]      = FILE_MAGIC;
 
 
-static uint32_t id_checksum()
+uint32_t files::id_checksum()
 // ----------------------------------------------------------------------------
 //   A checksum of all ID names, used to identify changes in binary format
 // ----------------------------------------------------------------------------
@@ -293,7 +293,6 @@ object_p files::recall_binary(text_p name) const
         uint32_t checksum = id_checksum();
         char     buf[sizeof(file_magic)];
         uint32_t check = 0;
-        char     c;
         size_t   sz;
         object_p result;
         if (!f.read(buf, sizeof(file_magic)))
@@ -311,12 +310,20 @@ object_p files::recall_binary(text_p name) const
             return nullptr;
         }
 
+        // Read the object directly into the scratchpad, in large chunks
         while (true)
         {
-            if (!f.read(&c, 1))
+            size_t room = 1024;
+            byte  *ptr  = rt.reserve(room);
+            if (!room)
+            {
+                rt.out_of_memory_error();
+                return nullptr;
+            }
+            size_t read = f.read_some((char *) ptr, room);
+            if (!read)
                 break;
-            byte *ptr = rt.allocate(1);
-            *ptr = c;
+            rt.allocate(read);
         }
 
         sz = rt.allocated();
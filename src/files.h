@@ -80,6 +80,9 @@ struct files : text
     // Purge (unlink) a file
     bool     purge(text_p name) const;
 
+    // Checksum of all ID names, identifying the binary format
+    static uint32_t id_checksum();
+
     // Build a file name from current path
     text_p   filename(text_p name, bool writing = false) const;
 };
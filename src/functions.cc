@@ -653,7 +653,7 @@ FUNCTION_BODY(inv)
 
     if (x->is_decimal())
         return decimal::inv(decimal_p(+x));
-    algebraic_g one = rt.make<integer>(ID_integer, 1);
+    algebraic_g one = integer::make(1);
     return one / x;
 }
 
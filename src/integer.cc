@@ -43,6 +43,36 @@
 
 RECORDER(integer, 16, "Integers");
 
+
+constexpr small_integers::small_integers()
+// ----------------------------------------------------------------------------
+//   Build the table of small integers at compile time
+// ----------------------------------------------------------------------------
+//   Each entry holds the LEB128 type followed by the LEB128 magnitude
+    : data()
+{
+    for (int i = MIN; i <= MAX; i++)
+    {
+        uint type  = i < 0 ? object::ID_neg_integer : object::ID_integer;
+        uint value = i < 0 ? -i : i;
+        uint n     = 0;
+        byte *p    = data[i - MIN];
+        do
+        {
+            p[n++] = (type & 0x7F) | (type >= 0x80 ? 0x80 : 0);
+            type >>= 7;
+        } while (type);
+        do
+        {
+            p[n++] = (value & 0x7F) | (value >= 0x80 ? 0x80 : 0);
+            value >>= 7;
+        } while (value);
+    }
+}
+
+constexpr small_integers SmallIntegers;
+
+
 SIZE_BODY(integer)
 // ----------------------------------------------------------------------------
 //   Compute size for all integers
@@ -152,12 +152,41 @@ using dec_integer   = special_integer<object::ID_dec_integer>;
 #endif // CONFIG_FIXED_BASED_OBJECTS
 using based_integer = special_integer<object::ID_based_integer>;
 
+struct small_integers
+// ----------------------------------------------------------------------------
+//   Read-only table of preallocated small integers
+// ----------------------------------------------------------------------------
+//   Small integer constants are frequently created, e.g. loop increments.
+//   Returning these read-only objects avoids allocating temporaries for them
+{
+    enum { MIN = -16, MAX = 256, SIZE = 4, COUNT = MAX - MIN + 1 };
+
+    constexpr small_integers();
+
+    template <typename Int>
+    static bool contains(Int value)
+    {
+        return value < 0 ? large(value) >= MIN : ularge(value) <= MAX;
+    }
+    integer_p operator[](large value) const
+    {
+        return integer_p(data[value - MIN]);
+    }
+
+    byte data[COUNT][SIZE];
+};
+
+extern const small_integers SmallIntegers;
+
+
 template <typename Int>
 integer_p integer::make(Int value)
 // ----------------------------------------------------------------------------
 //   Make an integer with the correct sign
 // ----------------------------------------------------------------------------
 {
+    if (small_integers::contains(value))
+        return SmallIntegers[value];
     return value < 0 ? rt.make<neg_integer>(-value) : rt.make<integer>(value);
 }
 
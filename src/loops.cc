@@ -578,11 +578,18 @@ static object::result counted_loop(object::id type, object_p o)
         // Get start value as local
         if (!rt.push(first))
             return object::ERROR;
-        rt.locals(1);
+        if (!rt.locals(1))
+        {
+            rt.drop();
+            return object::ERROR;
+        }
 
         // Pop local after execution
         if (!rt.run_push_data(nullptr, object_p(1)))
+        {
+            rt.unlocals(1);
             return object::ERROR;
+        }
     }
 
     object_g body = object_p(p);
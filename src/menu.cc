@@ -810,6 +810,11 @@ MENU(DebugMenu,
      "Kill",            ID_Kill,
      "Halt",            ID_Halt,
      "Step↑",           ID_StepOut,
+     "Profile",         ID_Profile,
+     "Optimize",        ID_Optimize,
+     "Memoize",         ID_Memoize,
+     "MemoStats",       ID_MemoStats,
+     "MemoFlush",       ID_MemoFlush,
      "Prog",            ID_ProgramMenu);
 
 
@@ -1454,7 +1459,10 @@ MENU(MemMenu,
      "Free",    ID_FreeMemory,
      "System",  ID_SystemMemory,
      "Recall",  ID_Rcl,
-     "PgAll",   ID_PurgeAll);
+     "PgAll",   ID_PurgeAll,
+
+     "GCStat",  ID_GCStats,
+     "GCRst",   ID_GCStatsReset);
 
 
 MENU(TimeMenu,
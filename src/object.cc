@@ -177,6 +177,191 @@ const object::dispatch object::handler[NUM_IDS] =
 };
 
 
+
+// ============================================================================
+//
+//   Parse dispatch on the first character
+//
+// ============================================================================
+//   Most of the NUM_IDS handlers return SKIP immediately, either because
+//   they are the default object or command parser (only the ID_Drop entry
+//   of the command parser does real work), or because their first character
+//   cannot match. The table below keeps only the handlers that can parse
+//   something, in the order of the original loop, with a mask of the
+//   character classes each one may start with.
+
+enum parse_class
+// ----------------------------------------------------------------------------
+//   Classes of initial characters used to pre-select parsers
+// ----------------------------------------------------------------------------
+{
+    PARSE_OTHER,                // Anything not listed below
+    PARSE_DIGIT,                // 0-9
+    PARSE_NAME,                 // Valid as name initial
+    PARSE_TEXT,                 // "
+    PARSE_LIST,                 // {
+    PARSE_ARRAY,                // [
+    PARSE_PROGRAM,              // «
+    PARSE_EXPRESSION,           // '
+    PARSE_CLASSES,
+
+    PARSE_ALL        = (1 << PARSE_CLASSES) - 1,
+    PARSE_DELIMITED  = ((1 << PARSE_TEXT)    |
+                        (1 << PARSE_LIST)    |
+                        (1 << PARSE_ARRAY)   |
+                        (1 << PARSE_PROGRAM) |
+                        (1 << PARSE_EXPRESSION)),
+    PARSE_CANDIDATES = 256,     // Maximum number of distinct parsers
+};
+
+
+static uint parse_classify(unicode cp)
+// ----------------------------------------------------------------------------
+//   Return the class for the initial character of an object
+// ----------------------------------------------------------------------------
+{
+    switch(cp)
+    {
+    case '"':   return PARSE_TEXT;
+    case '{':   return PARSE_LIST;
+    case '[':   return PARSE_ARRAY;
+    case L'«':  return PARSE_PROGRAM;
+    case '\'':  return PARSE_EXPRESSION;
+    default:    break;
+    }
+    if (cp >= '0' && cp <= '9')
+        return PARSE_DIGIT;
+    if (is_valid_as_name_initial(cp))
+        return PARSE_NAME;
+    return PARSE_OTHER;
+}
+
+
+static inline uint parse_bit(unicode cp)
+// ----------------------------------------------------------------------------
+//   Return the mask bit for a given initial character
+// ----------------------------------------------------------------------------
+{
+    return 1U << parse_classify(cp);
+}
+
+
+uint object::parse_mask(id ty)
+// ----------------------------------------------------------------------------
+//   Return the initial character classes a parser may accept
+// ----------------------------------------------------------------------------
+{
+    // Commands: collect the initials of all their spellings
+    if (ty == ID_Drop)
+    {
+        uint mask = 0;
+        for (size_t s = 0; s < spelling_count; s++)
+            if (cstring name = spellings[s].name)
+                if (is_command(spellings[s].type))
+                    mask |= parse_bit(utf8_codepoint(utf8(name)));
+        return mask;
+    }
+
+    // Unit menus parse their own name followed by "UnitsMenu"
+    if (handler[ty].parse == parse_fn(unit_menu::do_parse))
+        return parse_bit(utf8_codepoint(name(ty)));
+
+    switch(ty)
+    {
+    case ID_text:           return 1U << PARSE_TEXT;
+    case ID_list:           return 1U << PARSE_LIST;
+    case ID_array:          return 1U << PARSE_ARRAY;
+    case ID_program:        return 1U << PARSE_PROGRAM;
+    case ID_expression:     return 1U << PARSE_EXPRESSION;
+    case ID_comment:        return parse_bit('@');
+    case ID_tag:            return parse_bit(':');
+    case ID_locals:         return parse_bit(L'→') | parse_bit(L'▶');
+
+    case ID_symbol:
+    case ID_local:
+    case ID_directory:
+    case ID_grob:
+    case ID_bitmap:
+    case ID_IfThen:
+    case ID_IfThenElse:
+    case ID_IfErrThen:
+    case ID_IfErrThenElse:
+    case ID_DoUntil:
+    case ID_WhileRepeat:
+    case ID_StartNext:
+    case ID_StartStep:
+    case ID_ForNext:
+    case ID_ForStep:
+    case ID_CaseStatement:
+    case ID_CaseThen:
+    case ID_CaseWhen:
+        return 1U << PARSE_NAME;
+
+    default:
+        break;
+    }
+
+    // Numbers never start with a delimiter
+    if (is_real(ty) || is_based(ty) ||
+        is_complex(ty) || ty == ID_unit)
+        return PARSE_ALL & ~PARSE_DELIMITED;
+
+    return PARSE_ALL;
+}
+
+
+struct object::parse_candidate
+// ----------------------------------------------------------------------------
+//   An entry in the parse dispatch table
+// ----------------------------------------------------------------------------
+{
+    uint16_t    type;           // Candidate ID
+    uint16_t    mask;           // Classes of initial characters
+};
+
+
+size_t object::parse_candidates(const parse_candidate **table)
+// ----------------------------------------------------------------------------
+//   Build the parse dispatch table on first use
+// ----------------------------------------------------------------------------
+//   Returns 0 if the table does not fit, in which case we scan all IDs
+{
+    static parse_candidate candidates[PARSE_CANDIDATES];
+    static size_t          count = 0;
+    static bool            built = false;
+
+    if (!built)
+    {
+        parse_fn none    = handler[ID_object].parse;
+        parse_fn command = handler[ID_Drop].parse;
+        for (uint i = 0; i < NUM_IDS; i++)
+        {
+            // Parse ID_symbol last, we need to check commands first
+            uint candidate = (i + ID_symbol + 1) % NUM_IDS;
+            parse_fn parse = handler[candidate].parse;
+            if (parse == none)
+                continue;
+            if (parse == command && candidate != ID_Drop)
+                continue;
+            if (count >= PARSE_CANDIDATES)
+            {
+                record(parse, "Parse table overflow at ID %u", candidate);
+                count = 0;
+                break;
+            }
+            candidates[count].type = candidate;
+            candidates[count].mask = parse_mask(id(candidate));
+            count++;
+        }
+        record(parse, "Parse table has %u candidates out of %u IDs",
+               count, NUM_IDS);
+        built = true;
+    }
+    *table = candidates;
+    return count;
+}
+
+
 object_p object::parse(utf8 source, size_t &size, int precedence)
 // ----------------------------------------------------------------------------
 //  Try parsing the object as a top-level temporary
@@ -200,16 +385,29 @@ object_p object::parse(utf8 source, size_t &size, int precedence)
     size_t slen = 0;
     result r    = SKIP;
 
+    // Only try the handlers that can accept the initial character
+    const parse_candidate *table = nullptr;
+    size_t                 count = parse_candidates(&table);
+    size_t                 max   = count ? count : NUM_IDS;
+
     // Try parsing with the various handlers
     do
     {
         r = SKIP;
-        for (uint i = 0; r == SKIP && i < NUM_IDS; i++)
+        uint bit = parse_bit(utf8_codepoint(utf8(p.source)));
+        for (uint i = 0; r == SKIP && i < max; i++)
         {
             // Parse ID_symbol last, we need to check commands first
             uint candidate = (i + ID_symbol + 1) % NUM_IDS;
+            if (count)
+            {
+                if (~table[i].mask & bit)
+                    continue;
+                candidate = table[i].type;
+            }
             p.candidate = id(candidate);
-            record(parse_attempts, "Trying [%s] against %+s", src, name(id(i)));
+            record(parse_attempts, "Trying [%s] against %+s",
+                   src, name(id(candidate)));
             r = handler[candidate].parse(p);
             if (r == COMMENTED)
             {
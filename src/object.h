@@ -857,6 +857,10 @@ struct object
 protected:
     static const dispatch   handler[NUM_IDS];
 
+    struct parse_candidate;
+    static uint             parse_mask(id type);
+    static size_t           parse_candidates(const parse_candidate **table);
+
 #if DEBUG
 public:
     cstring debug() const;
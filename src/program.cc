@@ -28,8 +28,14 @@
 
 #include "program.h"
 
+#include "command.h"
+#include "conditionals.h"
+#include "integer.h"
 #include "parser.h"
 #include "settings.h"
+#include "symbol.h"
+#include "text.h"
+#include "unit.h"
 #include "variables.h"
 
 #ifdef SIMULATOR
@@ -95,6 +101,9 @@ program_p program::parse(utf8 source, size_t size)
 }
 
 
+static object::result memo_call(program_p prog);
+
+
 #ifdef DM42
 #  pragma GCC push_options
 #  pragma GCC optimize("-O3")
@@ -114,6 +123,16 @@ object::result program::run(bool synchronous) const
     record(program, "Run %p (%p-%p) %+s",
            this, first, end, outer ? "outer" : "inner");
 
+    if (first < end && first->type() == ID_Memoize)
+    {
+        program_g prog = this;
+        result    memo = memo_call(prog);
+        if (memo != SKIP)
+            return memo;
+        first = prog->objects();
+        end   = prog->skip();
+    }
+
     if (!rt.run_push(first, end))
         return ERROR;
     if (outer || synchronous)
@@ -140,6 +159,155 @@ object::result program::run(object_p obj, bool sync)
 #endif // DM42
 
 
+// Instructions between two reads of the clock, adapted to execution speed
+enum { POLL_BATCH_MAX = 1024 };
+static uint PollBatch     = 1;
+static uint PollCountdown = 1;
+static uint PollClock     = 0;
+static uint PollLast      = 0;
+
+static inline bool poll_due()
+// ----------------------------------------------------------------------------
+//   Check if it is time to poll the keyboard for interrupts
+// ----------------------------------------------------------------------------
+//   We read the clock every PollBatch instructions, and adjust the batch
+//   so that the clock is read a few times per polling interval. That way,
+//   EXIT is seen within about one polling interval, even if individual
+//   instructions are slow, without polling keys before each instruction.
+//   A zero interval polls before every instruction, even if the batch had
+//   grown while running with a longer interval.
+{
+    uint interval = Settings.PollingInterval();
+    if (!interval)
+    {
+        PollBatch = PollCountdown = 1;
+        return true;
+    }
+    if (--PollCountdown)
+        return false;
+
+    uint now   = sys_current_ms();
+    uint spent = now - PollClock;
+    PollClock = now;
+    if (spent * 4 < interval && PollBatch < POLL_BATCH_MAX)
+        PollBatch *= 2;
+    else if (spent > interval / 2 && PollBatch > 1)
+        PollBatch /= 2;
+    PollCountdown = PollBatch;
+
+    if (now - PollLast < interval)
+        return false;
+    PollLast = now;
+    return true;
+}
+
+
+// ============================================================================
+//
+//   Profiling
+//
+// ============================================================================
+//   While the Profile command runs, run_loop() counts instructions for each
+//   command type and calls to each global program. Time is sampled with
+//   sys_current_ms() and charged to the previous instruction, as well as to
+//   the innermost program being profiled on the return stack.
+
+struct profile_entry
+// ----------------------------------------------------------------------------
+//   Profiling data for a command type or a called program
+// ----------------------------------------------------------------------------
+{
+    object_g    key;            // Command, or name of the called program
+    object_g    value;          // Called program, nullptr for commands
+    uint        count;          // Number of executions
+    uint        ms;             // Accumulated time
+};
+
+enum { PROFILE_ENTRIES = 32 };
+static profile_entry *Profiling      = nullptr;
+static uint           ProfileUsed    = 0;
+static uint           ProfileLast    = 0;
+static uint           ProfileCurrent = ~0U;
+
+
+static uint profile_find(object_p key, object_p value)
+// ----------------------------------------------------------------------------
+//   Find or create the profiling entry for a key, ~0U if table is full
+// ----------------------------------------------------------------------------
+{
+    for (uint i = 0; i < ProfileUsed; i++)
+    {
+        profile_entry &e = Profiling[i];
+        if (+e.key == key)
+            return i;
+        if (value && e.value && symbol_p(+e.key)->is_same_as(symbol_p(key)))
+            return i;
+    }
+    if (ProfileUsed >= PROFILE_ENTRIES)
+        return ~0U;
+
+    profile_entry &e = Profiling[ProfileUsed];
+    e.key = key;
+    e.value = value;
+    e.count = 0;
+    e.ms = 0;
+    return ProfileUsed++;
+}
+
+
+static void profile_charge(uint elapsed)
+// ----------------------------------------------------------------------------
+//   Charge elapsed time to last instruction and innermost profiled program
+// ----------------------------------------------------------------------------
+{
+    if (ProfileCurrent < ProfileUsed)
+        Profiling[ProfileCurrent].ms += elapsed;
+
+    rt.run_calls([&](object_p next, object_p)
+    {
+        for (uint i = 0; i < ProfileUsed; i++)
+        {
+            profile_entry &e = Profiling[i];
+            if (e.value && next >= +e.value && next < e.value->skip())
+            {
+                e.ms += elapsed;
+                return true;
+            }
+        }
+        return false;
+    });
+}
+
+
+static void profile(object_p obj, object::id ty)
+// ----------------------------------------------------------------------------
+//   Record the execution of an instruction
+// ----------------------------------------------------------------------------
+{
+    uint now = sys_current_ms();
+    if (uint elapsed = now - ProfileLast)
+    {
+        ProfileLast = now;
+        profile_charge(elapsed);
+    }
+
+    ProfileCurrent = profile_find(object::static_object(ty), nullptr);
+    if (ProfileCurrent < ProfileUsed)
+        Profiling[ProfileCurrent].count++;
+
+    if (ty == object::ID_symbol)
+    {
+        object_p value = directory::recall_all(obj, false);
+        if (value && value->type() == object::ID_program)
+        {
+            uint e = profile_find(obj, value);
+            if (e < ProfileUsed)
+                Profiling[e].count++;
+        }
+    }
+}
+
+
 object::result program::run_loop(size_t depth)
 // ----------------------------------------------------------------------------
 //   Continue executing a program
@@ -151,10 +319,24 @@ object::result program::run_loop(size_t depth)
     bool     last_args =
         outer ? Settings.SaveLastArguments() : Settings.ProgramLastArguments();
 
+    // Decoded pairs depend on whether fusion is enabled
+    static bool fusing = false;
+    if (fusing != fused::enabled())
+    {
+        fusing = !fusing;
+        rt.run_cache_flush();
+    }
+
     save<bool> save_running(running, true);
     while (object_p obj = rt.run_next(depth))
     {
-        if (interrupted())
+        // Reuse the type decoded by run_next(), which may fuse two objects
+        const runtime::run_entry &cached = rt.run_cached(obj);
+        id ty = cached.object == obj ? id(cached.type) : obj->type();
+        if (ty >= ID_fused_dup_mul && ty <= ID_fused_zero_same)
+            obj = static_object(ty);
+
+        if ((halted || poll_due()) && interrupted())
         {
             obj->defer();
             if (!halted)
@@ -168,7 +350,11 @@ object::result program::run_loop(size_t depth)
         {
             if (last_args)
                 rt.need_save();
-            result = obj->evaluate();
+
+            record(eval, "Evaluating %t", obj);
+            if (Profiling)
+                profile(obj, ty);
+            result = handler[ty].evaluate(obj);
         }
 
         if (stepping)
@@ -252,6 +438,413 @@ EVAL_BODY(block)
 
 
 
+// ============================================================================
+//
+//   Fused objects
+//
+// ============================================================================
+//   Frequent pairs like `dup *` or `1 +` are decoded by run_next() as
+//   a single fused type that evaluates both parts, which saves one trip
+//   through run_next(), interrupt polling and LastArgs bookkeeping in
+//   run_loop(). Programs are left unchanged, so that commands such as
+//   Size, Get or Obj→ still see the original objects.
+//   The first part never saves arguments, so LastArgs is unchanged.
+//   The NoCommandFusion flag disables fusion, e.g. to compare performance,
+//   and so does single-stepping, so that each step runs one object.
+
+struct fusion
+// ----------------------------------------------------------------------------
+//   Description of a fused pair, in the same order as in ids.tbl
+// ----------------------------------------------------------------------------
+{
+    object::id  fused;          // Fused object
+    object::id  first;          // First command, or ID_integer for a value
+    int         value;          // Small integer value if first is ID_integer
+    object::id  second;         // Second command
+};
+
+static const fusion Fusions[] =
+{
+    { object::ID_fused_dup_mul,   object::ID_Dup,     0, object::ID_mul },
+    { object::ID_fused_swap_drop, object::ID_Swap,    0, object::ID_Drop },
+    { object::ID_fused_over_over, object::ID_Over,    0, object::ID_Over },
+    { object::ID_fused_one_add,   object::ID_integer, 1, object::ID_add },
+    { object::ID_fused_one_sub,   object::ID_integer, 1, object::ID_sub },
+    { object::ID_fused_zero_same, object::ID_integer, 0, object::ID_TestSame },
+};
+
+
+static inline object_p fusion_first(const fusion &f)
+// ----------------------------------------------------------------------------
+//   Return the first part of a fused pair
+// ----------------------------------------------------------------------------
+{
+    if (f.first == object::ID_integer)
+        return SmallIntegers[f.value];
+    return object::static_object(f.first);
+}
+
+
+object_p fused::first(id type)
+// ----------------------------------------------------------------------------
+//   Return the first part of a fused object
+// ----------------------------------------------------------------------------
+{
+    return fusion_first(Fusions[type - ID_fused_dup_mul]);
+}
+
+
+object_p fused::second(id type)
+// ----------------------------------------------------------------------------
+//   Return the second part of a fused object
+// ----------------------------------------------------------------------------
+{
+    return static_object(Fusions[type - ID_fused_dup_mul].second);
+}
+
+
+bool fused::enabled()
+// ----------------------------------------------------------------------------
+//   Check if pairs are fused when running programs
+// ----------------------------------------------------------------------------
+{
+    return !Settings.NoCommandFusion() && !program::stepping;
+}
+
+
+object::id fused::pair(object_p obj, id type, object_p &next)
+// ----------------------------------------------------------------------------
+//   Return the fused type if an object and the next one form a known pair
+// ----------------------------------------------------------------------------
+//   On success, 'next' is updated to point after the second object
+{
+    if (type != ID_integer && type != ID_Dup &&
+        type != ID_Swap    && type != ID_Over)
+        return type;
+    if (!enabled())
+        return type;
+
+    id     nty = next->type();
+    size_t sz  = next - obj;
+    for (const fusion &f : Fusions)
+    {
+        if (f.second != nty)
+            continue;
+        object_p first = fusion_first(f);
+        if (sz != first->size() || memcmp(obj, first, sz) != 0)
+            continue;
+        next = next->skip();
+        return f.fused;
+    }
+    return type;
+}
+
+
+uint runtime::run_fuse(object_p obj, uint type, object_p &next)
+// ----------------------------------------------------------------------------
+//   Decode a pair of objects that can run as one
+// ----------------------------------------------------------------------------
+{
+    return fused::pair(obj, object::id(type), next);
+}
+
+
+PARSE_BODY(fused)
+// ----------------------------------------------------------------------------
+//   Fused objects are only created by the run cache, never parsed
+// ----------------------------------------------------------------------------
+{
+    return SKIP;
+}
+
+
+RENDER_BODY(fused)
+// ----------------------------------------------------------------------------
+//   Render the original pair
+// ----------------------------------------------------------------------------
+{
+    id ty = o->type();
+    first(ty)->render(r);
+    r.wantSpace();
+    second(ty)->render(r);
+    return r.size();
+}
+
+
+EVAL_BODY(fused)
+// ----------------------------------------------------------------------------
+//   Evaluate both parts in sequence
+// ----------------------------------------------------------------------------
+{
+    id     ty     = o->type();
+    result result = first(ty)->evaluate();
+    if (result == OK)
+        result = second(ty)->evaluate();
+    return result;
+}
+
+
+// ============================================================================
+//
+//   Memoized programs
+//
+// ============================================================================
+//   A program that begins with `Memoize` remembers its result for given
+//   arguments. The number of arguments is the number of names in the locals
+//   block that follows `Memoize`, e.g. `« Memoize → n « ... » »`. The result
+//   is only cached if the program returned exactly one value.
+//   The cache is direct-mapped, indexed by a hash of the program and argument
+//   bytes. Each entry is a single list holding a copy of the program, of the
+//   arguments and of the result, so that entries are matched on content, and
+//   remain valid when the program is moved, modified or purged. This also
+//   keeps a single GC-safe pointer per entry. The cache is flushed when the
+//   runtime memory is reset or when garbage collection runs short of memory.
+
+struct memo_entry
+// ----------------------------------------------------------------------------
+//   An entry in the memoization cache
+// ----------------------------------------------------------------------------
+{
+    list_g      data;           // Program, arguments deepest first, value
+    uint        hash;           // Hash of program and arguments
+};
+
+enum { MEMO_ENTRIES = 64 };
+static uint MemoHits   = 0;
+static uint MemoMisses = 0;
+
+
+static memo_entry *memo_cache()
+// ----------------------------------------------------------------------------
+//   Return the cache, constructed on first use once the runtime is ready
+// ----------------------------------------------------------------------------
+{
+    static memo_entry cache[MEMO_ENTRIES];
+    return cache;
+}
+
+
+static uint memo_hash(uint hash, object_p obj)
+// ----------------------------------------------------------------------------
+//   Add the bytes of an object to a FNV-1a hash
+// ----------------------------------------------------------------------------
+{
+    byte_p p   = byte_p(obj);
+    size_t len = obj->size();
+    while (len--)
+        hash = (hash ^ *p++) * 16777619U;
+    return hash;
+}
+
+
+static inline bool memo_same(object_p x, object_p y)
+// ----------------------------------------------------------------------------
+//   Check if two objects have the same bytes
+// ----------------------------------------------------------------------------
+{
+    size_t size = x->size();
+    return y->size() == size && memcmp(x, y, size) == 0;
+}
+
+
+static object_p memo_match(list_p data, program_p prog, uint arity)
+// ----------------------------------------------------------------------------
+//   Return the cached value if program and arguments on the stack match
+// ----------------------------------------------------------------------------
+{
+    size_t   size  = 0;
+    object_p obj   = data->objects(&size);
+    object_p end   = obj + size;
+    if (obj >= end || !memo_same(obj, prog))
+        return nullptr;
+    obj = obj->skip();
+    for (uint level = arity; level > 0; level--)
+    {
+        object_p arg = rt.stack(level - 1);
+        if (obj >= end || !arg || !memo_same(obj, arg))
+            return nullptr;
+        obj = obj->skip();
+    }
+    return obj < end ? obj : nullptr;
+}
+
+
+static object::result memo_call(program_p prog)
+// ----------------------------------------------------------------------------
+//   Return a cached value, or prepare to record it after running the program
+// ----------------------------------------------------------------------------
+//   Returns SKIP if the program needs to run
+{
+    program_g program = prog;
+    object_p  memo    = prog->objects();
+    object_p  next    = memo->skip();
+    uint      arity   = 0;
+    if (next < prog->skip() && next->type() == object::ID_locals)
+    {
+        byte_p p = next->payload();
+        leb128<size_t>(p);
+        arity = leb128<size_t>(p);
+    }
+    if (rt.depth() < arity)
+        return object::SKIP;    // Let the program report the error
+
+    uint hash = memo_hash(2166136261U, prog);
+    for (uint level = arity; level > 0; level--)
+        if (object_p arg = rt.stack(level - 1))
+            hash = memo_hash(hash, arg);
+
+    memo_entry &entry = memo_cache()[hash % MEMO_ENTRIES];
+    if (entry.data && entry.hash == hash)
+    {
+        if (object_p value = memo_match(entry.data, prog, arity))
+        {
+            MemoHits++;
+            if (rt.drop(arity) && rt.push(value))
+                return object::OK;
+            return object::ERROR;
+        }
+    }
+    MemoMisses++;
+
+    // Copy the program and the arguments, which the program will consume
+    list_g key;
+    {
+        scribble scr;
+        if (!rt.append(program->size(), byte_p(+program)))
+            return object::ERROR;
+        for (uint level = arity; level > 0; level--)
+        {
+            object_g arg = rt.stack(level - 1);
+            if (!arg || !rt.append(arg->size(), byte_p(+arg)))
+                return object::ERROR;
+        }
+        key = list::make(scr.scratch(), scr.growth());
+        if (!key)
+            return object::ERROR;
+    }
+
+    // Push program, expected depth and key for memo_store, which runs
+    // after the program. The depth is below the program, so run_next() would
+    // simply drop that entry.
+    size_t depth = rt.depth() - arity + 1;
+    if (!rt.run_push_data(+program, object_p(depth)) ||
+        !rt.run_push(+key, key->skip())              ||
+        !object::defer(object::ID_memo_store))
+        return object::ERROR;
+    return object::SKIP;
+}
+
+
+PARSE_BODY(memo_store)
+// ----------------------------------------------------------------------------
+//   A memo_store object is never parsed
+// ----------------------------------------------------------------------------
+{
+    return SKIP;
+}
+
+
+RENDER_BODY(memo_store)
+// ----------------------------------------------------------------------------
+//   Display for debugging purpose
+// ----------------------------------------------------------------------------
+{
+    r.put("<memoize>");
+    return r.size();
+}
+
+
+EVAL_BODY(memo_store)
+// ----------------------------------------------------------------------------
+//   Record the value returned by a memoized program
+// ----------------------------------------------------------------------------
+{
+    list_g   key     = list_p(rt.run_frame(0));
+    size_t   depth   = size_t(rt.run_frame(3));
+    rt.run_drop();
+    rt.run_drop();
+    if (!key)
+        return ERROR;
+    if (rt.depth() != depth)
+        return OK;              // Not exactly one value, do not cache
+
+    object_g value = rt.top();
+    if (!value)
+        return ERROR;
+
+    uint     hash = 2166136261U;
+    for (object_p obj : *key)
+        hash = memo_hash(hash, obj);
+
+    // Copying the value also detaches it from global variables
+    list_g   data;
+    {
+        scribble scr;
+        size_t   size = 0;
+        object_g objs = key->objects(&size);
+        if (!rt.append(size, byte_p(+objs)) ||
+            !rt.append(value->size(), byte_p(+value)))
+            return ERROR;
+        data = list::make(scr.scratch(), scr.growth());
+        if (!data)
+            return ERROR;
+    }
+
+    memo_entry &entry = memo_cache()[hash % MEMO_ENTRIES];
+    entry.data = data;
+    entry.hash = hash;
+    return OK;
+}
+
+
+COMMAND_BODY(Memoize)
+// ----------------------------------------------------------------------------
+//   Mark a program as memoized - Nothing to do at run time
+// ----------------------------------------------------------------------------
+{
+    return OK;
+}
+
+
+COMMAND_BODY(MemoStats)
+// ----------------------------------------------------------------------------
+//   Return the number of cache hits and misses for memoized programs
+// ----------------------------------------------------------------------------
+{
+    integer_g hits   = integer::make(MemoHits);
+    integer_g misses = integer::make(MemoMisses);
+    if (!hits || !misses)
+        return ERROR;
+    list_p result = list::make(hits, misses);
+    if (result && rt.push(result))
+        return OK;
+    return ERROR;
+}
+
+
+void program::memo_flush()
+// ----------------------------------------------------------------------------
+//   Empty the memoization cache
+// ----------------------------------------------------------------------------
+{
+    memo_entry *cache = memo_cache();
+    for (uint i = 0; i < MEMO_ENTRIES; i++)
+        cache[i].data = nullptr;
+}
+
+
+COMMAND_BODY(MemoFlush)
+// ----------------------------------------------------------------------------
+//   Empty the memoization cache and reset statistics
+// ----------------------------------------------------------------------------
+{
+    program::memo_flush();
+    MemoHits = 0;
+    MemoMisses = 0;
+    return OK;
+}
+
+
 // ============================================================================
 //
 //   Debugging
@@ -317,6 +910,12 @@ COMMAND_BODY(StepOver)
 {
     if (object_p next = rt.run_next(0))
     {
+        // A fused pair was consumed as a whole by run_next()
+        const runtime::run_entry &cached = rt.run_cached(next);
+        if (cached.object == next &&
+            cached.type >= ID_fused_dup_mul && cached.type <= ID_fused_zero_same)
+            next = static_object(id(cached.type));
+
         size_t depth = rt.call_depth();
         save<bool> no_halt(program::halted, false);
         if (!next->defer())
@@ -374,6 +973,427 @@ COMMAND_BODY(Continue)
 }
 
 
+static bool profile_result(const profile_entry &e)
+// ----------------------------------------------------------------------------
+//   Append a list with name, count and time for an entry to the scratchpad
+// ----------------------------------------------------------------------------
+{
+    scribble   scr;
+    object_g   name = +e.key;
+    object::id ty   = name->type();
+    if (ty >= object::ID_fused_dup_mul && ty <= object::ID_fused_zero_same)
+        name = name->as_text(false, false);
+    else if (!e.value && !object::is_command(ty))
+        name = text::make(object::name(ty));
+    integer_g count = integer::make(e.count);
+    integer_g ms    = integer::make(e.ms);
+    symbol_g  unit  = symbol::make("ms");
+    unit_g    time  = ms && unit ? unit::make(+ms, +unit) : nullptr;
+    if (!name || !count || !time)
+        return false;
+    if (!rt.append(name->size(), byte_p(+name))   ||
+        !rt.append(count->size(), byte_p(+count)) ||
+        !rt.append(time->size(), byte_p(+time)))
+        return false;
+    list_g entry = list::make(scr.scratch(), scr.growth());
+    scr.clear();
+    return entry && rt.append(entry->size(), byte_p(+entry));
+}
+
+
+COMMAND_BODY(Profile)
+// ----------------------------------------------------------------------------
+//   Evaluate an object and return execution counts and times
+// ----------------------------------------------------------------------------
+//   The result is a list of { Name Count Time } sorted by decreasing time,
+//   where Name is a command, the name of a called program, or the name of
+//   the type for other objects (e.g. integer for numbers pushed on the stack)
+{
+    if (!rt.args(1))
+        return ERROR;
+
+    profile_entry entries[PROFILE_ENTRIES];
+    save<profile_entry *> save_profiling(Profiling, entries);
+    save<uint>            save_used(ProfileUsed, 0);
+    save<uint>            save_current(ProfileCurrent, ~0U);
+    save<uint>            save_last(ProfileLast, sys_current_ms());
+
+    if (result err = Eval::do_evaluate())
+        return err;
+    if (uint elapsed = sys_current_ms() - ProfileLast)
+        profile_charge(elapsed);
+
+    // Sort by decreasing time, then decreasing count
+    uint used = ProfileUsed;
+    for (uint i = 1; i < used; i++)
+    {
+        for (uint j = i; j > 0; j--)
+        {
+            profile_entry &a = entries[j-1];
+            profile_entry &b = entries[j];
+            if (a.ms > b.ms || (a.ms == b.ms && a.count >= b.count))
+                break;
+            std::swap(a, b);
+        }
+    }
+
+    scribble scr;
+    for (uint i = 0; i < used; i++)
+        if (!profile_result(entries[i]))
+            return ERROR;
+    list_p result = list::make(scr.scratch(), scr.growth());
+    if (result && rt.push(result))
+        return OK;
+    return ERROR;
+}
+
+
+// ============================================================================
+//
+//   Program optimization
+//
+// ============================================================================
+//   Optimize replaces sequences of exact literal values followed by pure
+//   arithmetic, comparison or logical commands with their result, and removes
+//   conditional branches that can never be taken. Decimal values and based
+//   numbers are left alone, since the result depends on settings such as
+//   Precision or WordSize that may change before the program runs.
+
+struct optimizer
+// ----------------------------------------------------------------------------
+//   State while copying an optimized sequence of objects to the scratchpad
+// ----------------------------------------------------------------------------
+{
+    enum { LITERALS = 4 };
+
+    optimizer(): literals(0) {}
+
+    bool           sequence(list_p seq);
+    bool           emit(object_g obj);
+    bool           append(object_g obj);
+    object::result fold(object::id cmd, uint arity, bool logical);
+    object::result structure(object_g obj);
+
+    uint           literals;            // Number of trailing literal values
+    size_t         offset[LITERALS];    // Scratchpad offsets of literals
+    object_g       value[LITERALS];     // Trailing literal values
+};
+
+
+static bool optimizer_literal(object_p obj)
+// ----------------------------------------------------------------------------
+//   Check if an object is a literal whose value cannot depend on settings
+// ----------------------------------------------------------------------------
+{
+    object::id ty = obj->type();
+    if (ty == object::ID_True || ty == object::ID_False)
+        return true;
+    return (object::is_integer(ty)  ||
+            object::is_bignum(ty)   ||
+            object::is_fraction(ty)) && !object::is_based(ty);
+}
+
+
+static uint optimizer_arity(object::id ty, bool &logical)
+// ----------------------------------------------------------------------------
+//   Return the number of arguments of a command that can be folded, or 0
+// ----------------------------------------------------------------------------
+{
+    logical = false;
+    switch(ty)
+    {
+    case object::ID_neg:
+    case object::ID_abs:
+    case object::ID_inv:
+    case object::ID_sq:
+    case object::ID_cubed:
+        return 1;
+
+    case object::ID_add:
+    case object::ID_sub:
+    case object::ID_mul:
+    case object::ID_div:
+    case object::ID_mod:
+    case object::ID_rem:
+    case object::ID_pow:
+    case object::ID_same:
+    case object::ID_TestSame:
+    case object::ID_TestLT:
+    case object::ID_TestEQ:
+    case object::ID_TestGT:
+    case object::ID_TestLE:
+    case object::ID_TestNE:
+    case object::ID_TestGE:
+        return 2;
+
+    case object::ID_Not:
+        logical = true;
+        return 1;
+
+    case object::ID_And:
+    case object::ID_Or:
+    case object::ID_Xor:
+    case object::ID_NAnd:
+    case object::ID_NOr:
+    case object::ID_Implies:
+    case object::ID_Equiv:
+    case object::ID_Excludes:
+        logical = true;
+        return 2;
+
+    default:
+        return 0;
+    }
+}
+
+
+static bool optimizer_constant(object_p blk, bool &truth)
+// ----------------------------------------------------------------------------
+//   Check if a block only contains a literal, and return its truth value
+// ----------------------------------------------------------------------------
+{
+    if (blk->type() != object::ID_block)
+        return false;
+    size_t   size  = 0;
+    object_p first = list_p(blk)->objects(&size);
+    if (!size || first->size() != size || !optimizer_literal(first))
+        return false;
+    int value = first->as_truth(false);
+    if (value < 0)
+        return false;
+    truth = value;
+    return true;
+}
+
+
+static object_p optimizer_block(object_p blk)
+// ----------------------------------------------------------------------------
+//   Return an optimized copy of a block
+// ----------------------------------------------------------------------------
+{
+    if (blk->type() != object::ID_block)
+        return blk;
+    scribble  scr;
+    optimizer opt;
+    if (!opt.sequence(list_p(blk)))
+        return nullptr;
+    return rt.make<program>(object::ID_block, scr.scratch(), scr.growth());
+}
+
+
+bool optimizer::sequence(list_p seq)
+// ----------------------------------------------------------------------------
+//   Optimize all objects in a program or block
+// ----------------------------------------------------------------------------
+{
+    list_g list = seq;
+    for (object_p obj : *list)
+        if (!emit(obj))
+            return false;
+    return true;
+}
+
+
+bool optimizer::emit(object_g obj)
+// ----------------------------------------------------------------------------
+//   Optimize one object, folding it with the previous ones if possible
+// ----------------------------------------------------------------------------
+{
+    object::id ty = obj->type();
+    bool logical = false;
+    uint arity   = optimizer_arity(ty, logical);
+    if (arity && arity <= literals)
+    {
+        object::result r = fold(ty, arity, logical);
+        if (r != object::SKIP)
+            return r == object::OK;
+    }
+
+    object::result r = structure(obj);
+    if (r != object::SKIP)
+        return r == object::OK;
+
+    return append(obj);
+}
+
+
+bool optimizer::append(object_g obj)
+// ----------------------------------------------------------------------------
+//   Copy an object to the scratchpad, fusing frequent pairs
+// ----------------------------------------------------------------------------
+{
+    size_t current = rt.allocated();
+    size_t objsize = obj->size();
+    byte  *objcopy = rt.allocate(objsize);
+    if (!objcopy)
+        return false;
+    memmove(objcopy, +obj, objsize);
+
+    if (optimizer_literal(obj))
+    {
+        if (literals >= LITERALS)
+        {
+            for (uint i = 1; i < LITERALS; i++)
+            {
+                offset[i-1] = offset[i];
+                value[i-1] = value[i];
+            }
+            literals--;
+        }
+        offset[literals] = current;
+        value[literals] = obj;
+        literals++;
+    }
+    else
+    {
+        literals = 0;
+    }
+    return true;
+}
+
+
+object::result optimizer::fold(object::id cmd, uint arity, bool logical)
+// ----------------------------------------------------------------------------
+//   Replace the last literals with the result of the command
+// ----------------------------------------------------------------------------
+{
+    uint first = literals - arity;
+    for (uint i = first; i < literals; i++)
+    {
+        object::id ty = value[i]->type();
+        bool boolean = ty == object::ID_True || ty == object::ID_False;
+        if (boolean != logical)
+            return object::SKIP;
+    }
+
+    // Evaluate the command on the stack, and discard anything it left there
+    object_g folded = nullptr;
+    {
+        stack_depth_restore sdr;
+        uint depth = rt.depth();
+        for (uint i = first; i < literals; i++)
+            if (!rt.push(+value[i]))
+                return object::ERROR;
+        if (object::static_object(cmd)->evaluate() == object::OK &&
+            rt.depth() == depth + 1)
+            folded = rt.top();
+    }
+    if (!folded || !optimizer_literal(folded))
+    {
+        // Errors such as division by zero are left for run time
+        rt.clear_error();
+        return object::SKIP;
+    }
+
+    rt.free(rt.allocated() - offset[first]);
+    literals = first;
+    return append(folded) ? object::OK : object::ERROR;
+}
+
+
+object::result optimizer::structure(object_g obj)
+// ----------------------------------------------------------------------------
+//   Optimize the blocks in a conditional or loop, removing dead branches
+// ----------------------------------------------------------------------------
+//   ForNext and ForStep are left alone, since their body refers to a local
+{
+    object::id ty    = obj->type();
+    uint       parts = 0;
+    switch(ty)
+    {
+    case object::ID_StartNext:
+    case object::ID_StartStep:
+        parts = 1;
+        break;
+    case object::ID_IfThen:
+    case object::ID_IfErrThen:
+    case object::ID_DoUntil:
+    case object::ID_WhileRepeat:
+        parts = 2;
+        break;
+    case object::ID_IfThenElse:
+    case object::ID_IfErrThenElse:
+        parts = 3;
+        break;
+    default:
+        return object::SKIP;
+    }
+
+    object_g part[3];
+    object_p p = object_p(obj->payload());
+    for (uint i = 0; i < parts; i++)
+    {
+        part[i] = p;
+        p = p->skip();
+    }
+
+    // Optimize the condition, and check if it is a constant
+    part[0] = optimizer_block(part[0]);
+    if (!part[0])
+        return object::ERROR;
+    bool truth = false;
+    if ((ty == object::ID_IfThen     ||
+         ty == object::ID_IfThenElse ||
+         ty == object::ID_WhileRepeat) &&
+        optimizer_constant(part[0], truth) &&
+        (ty != object::ID_WhileRepeat || !truth))
+    {
+        // A while loop with a false condition never runs its body
+        if (ty == object::ID_WhileRepeat)
+            return object::OK;
+
+        // Inline the branch being taken, drop the other one
+        object_p taken = truth ? +part[1] : parts > 2 ? +part[2] : nullptr;
+        if (!taken)
+            return object::OK;
+        return sequence(list_p(taken)) ? object::OK : object::ERROR;
+    }
+
+    for (uint i = 1; i < parts; i++)
+    {
+        part[i] = optimizer_block(part[i]);
+        if (!part[i])
+            return object::ERROR;
+    }
+
+    object_g made = parts == 1
+        ? object_p(rt.make<loop>(ty, part[0], nullptr))
+        : parts == 2
+        ? object_p(rt.make<conditional_loop>(ty, part[0], part[1]))
+        : object_p(rt.make<IfThenElse>(ty, part[0], part[1], part[2]));
+    if (!made)
+        return object::ERROR;
+    return append(made) ? object::OK : object::ERROR;
+}
+
+
+COMMAND_BODY(Optimize)
+// ----------------------------------------------------------------------------
+//   Return an optimized version of the program in level 1
+// ----------------------------------------------------------------------------
+{
+    if (!rt.args(1))
+        return ERROR;
+    object_p obj = rt.top();
+    if (!obj)
+        return ERROR;
+    if (obj->type() != ID_program)
+    {
+        rt.type_error();
+        return ERROR;
+    }
+
+    scribble  scr;
+    optimizer opt;
+    if (!opt.sequence(list_p(obj)))
+        return ERROR;
+    object_p prog = rt.make<program>(ID_program, scr.scratch(), scr.growth());
+    if (prog && rt.top(prog))
+        return OK;
+    return ERROR;
+}
+
+
 COMMAND_BODY(Kill)
 // ----------------------------------------------------------------------------
 //   Kill program execution
@@ -52,6 +52,7 @@ struct program : list
 
     static bool      interrupted(); // Program interrupted e.g. by EXIT key
     static program_p parse(utf8 source, size_t size);
+    static void      memo_flush();  // Empty the cache of memoized programs
 
     static bool running, halted;
     static uint stepping;
@@ -80,6 +81,58 @@ public:
 };
 
 
+struct fused : object
+// ----------------------------------------------------------------------------
+//   A pair of objects in a program run as one to save a dispatch
+// ----------------------------------------------------------------------------
+//   Fused objects are never stored in programs. The run cache decodes a pair
+//   as a fused type, and the program loop then evaluates the static object
+//   for that type. They render as the original pair, e.g. `dup ×` or `1 +`
+{
+    fused(id type): object(type) {}
+
+    static id       pair(object_p obj, id type, object_p &next);
+    static bool     enabled();
+    static object_p first(id type);
+    static object_p second(id type);
+
+public:
+    OBJECT_DECL(fused);
+    PARSE_DECL(fused);
+    RENDER_DECL(fused);
+    EVAL_DECL(fused);
+};
+
+#define FUSED_DECLARE(derived)                          \
+struct derived : fused                                  \
+{                                                       \
+    derived(id type = ID_##derived): fused(type) {}     \
+    OBJECT_DECL(derived);                               \
+}
+
+FUSED_DECLARE(fused_dup_mul);
+FUSED_DECLARE(fused_swap_drop);
+FUSED_DECLARE(fused_over_over);
+FUSED_DECLARE(fused_one_add);
+FUSED_DECLARE(fused_one_sub);
+FUSED_DECLARE(fused_zero_same);
+
+
+struct memo_store : object
+// ----------------------------------------------------------------------------
+//   A non-parseable object recording the result of a memoized program
+// ----------------------------------------------------------------------------
+{
+    memo_store(id type): object(type) {}
+
+public:
+    OBJECT_DECL(memo_store);
+    PARSE_DECL(memo_store);
+    RENDER_DECL(memo_store);
+    EVAL_DECL(memo_store);
+};
+
+
 COMMAND_DECLARE(Halt);
 COMMAND_DECLARE(Debug);
 COMMAND_DECLARE(SingleStep);
@@ -88,5 +141,10 @@ COMMAND_DECLARE(StepOut);
 COMMAND_DECLARE(MultipleSteps);
 COMMAND_DECLARE(Continue);
 COMMAND_DECLARE(Kill);
+COMMAND_DECLARE(Profile);
+COMMAND_DECLARE(Optimize);
+COMMAND_DECLARE(Memoize);
+COMMAND_DECLARE(MemoStats);
+COMMAND_DECLARE(MemoFlush);
 
 #endif // PROGRAM_H
@@ -32,6 +32,7 @@
 #include "arithmetic.h"
 #include "compare.h"
 #include "constants.h"
+#include "dmcp.h"
 #include "integer.h"
 #include "object.h"
 #include "program.h"
@@ -44,6 +45,15 @@
 // The one and only runtime
 runtime rt(nullptr, 0);
 runtime::gcptr *runtime::GCSafe = nullptr;
+uint            runtime::GCSafeCount = 0;
+uint            runtime::GCSafePeak = 0;
+runtime::gcstats runtime::GCStatistics = { };
+#if CONFIG_GC_ALLOCATIONS
+uint            runtime::GCAllocated[object::NUM_IDS] = { };
+#endif // CONFIG_GC_ALLOCATIONS
+runtime::run_entry runtime::RunCache[RUN_CACHE] = { };
+uint            runtime::GlobalsGeneration = 0;
+uint            runtime::DirectoriesGeneration = 0;
 
 RECORDER(runtime,       16, "RPL runtime");
 RECORDER(runtime_error, 16, "RPL runtime error (anomalous behaviors)");
@@ -71,17 +81,22 @@ runtime::runtime(byte *mem, size_t size)
       ErrorCommand(nullptr),
       LowMem(),
       Globals(),
+      Slack(),
       Temporaries(),
+      Nursery(),
       Editing(),
       Scratch(),
       Stack(),
       Args(),
       Undo(),
-      Locals(),
       Directories(),
       CallStack(),
       Returns(),
       HighMem(),
+      LocalFrames(),
+      LocalCount(0),
+      UndoDepth(0),
+      UndoBase(0),
       SaveArgs(false)
 {
     if (mem)
@@ -101,19 +116,27 @@ void runtime::memory(byte *memory, size_t size)
     Returns = HighMem;                          // No return stack
     CallStack = Returns;                        // Reserve space for call stack
     Directories = CallStack - 1;                // Make room for one path
-    Locals = Directories;                       // No locals
-    Args = Locals;                              // No args
-    Undo = Locals;                              // No undo stack
-    Stack = Locals;                             // Empty stack
+    Args = Directories;                         // No args
+    Undo = Directories;                         // No undo journal
+    Stack = Directories;                        // Empty stack
+    LocalFrames = nullptr;                      // No locals
+    LocalCount = 0;
+    UndoDepth = 0;                              // Nothing to undo
+    UndoBase = 0;
 
     // Stuff at bottom of memory
     Globals = LowMem;
     directory_p home = new((void *) Globals) directory();   // Home directory
     *Directories = (object_p) home;             // Current search path
     Globals = home->skip();                     // Globals after home
-    Temporaries = Globals;                      // Area for temporaries
+    Slack = 1;                                  // Minimum slack
+    Temporaries = Globals + Slack;              // Area for temporaries
+    Nursery = Temporaries;                      // No recent temporaries
     Editing = 0;                                // No editor
     Scratch = 0;                                // No scratchpad
+    directories_changed();                      // Invalidate caches
+    directory::index_flush();                   // Drop directory indexes
+    program::memo_flush();                      // Drop memoized results
 
     record(runtime, "Memory %p-%p size %u (%uK)",
            LowMem, HighMem, size, size>>10);
@@ -159,8 +182,7 @@ size_t runtime::available(size_t size)
 {
     if (available() < size)
     {
-        gc();
-        size_t avail = available();
+        size_t avail = reclaim(size);
         if (avail < size)
             out_of_memory_error();
         return avail;
@@ -169,6 +191,26 @@ size_t runtime::available(size_t size)
 }
 
 
+size_t runtime::reclaim(size_t size)
+// ----------------------------------------------------------------------------
+//   Collect garbage until we have the given size, return what is available
+// ----------------------------------------------------------------------------
+{
+    // Try a minor collection first, then a full one if that's not enough
+    if (Nursery < Temporaries)
+        gc(true);
+    if (available() < size)
+    {
+        directory::index_flush();
+        program::memo_flush();
+        gc();
+    }
+    if (available() < size && Slack > 1)
+        release_slack();
+    return available();
+}
+
+
 
 // ============================================================================
 //
@@ -197,8 +239,9 @@ bool runtime::integrity_test(object_p first,
     if (obj != last)
         return false;
 
+    // Unused entries in the undo journal are null
     for (object_p *s = stack; s < stackEnd; s++)
-        if (!*s || (*s)->type() >= object::NUM_IDS)
+        if (*s ? (*s)->type() >= object::NUM_IDS : s < rt.Undo || s >= rt.Directories)
             return false;
 
     return true;
@@ -210,7 +253,8 @@ bool runtime::integrity_test()
 //   Check all the objects in a given range
 // ----------------------------------------------------------------------------
 {
-    return integrity_test(rt.Globals,rt.Temporaries,rt.Stack,rt.CallStack);
+    return integrity_test(rt.Globals + rt.Slack, rt.Temporaries,
+                          rt.Stack, rt.CallStack);
 }
 
 
@@ -258,7 +302,7 @@ void runtime::dump_object_list(cstring  message)
 // ----------------------------------------------------------------------------
 {
     dump_object_list(message,
-                     rt.Globals, rt.Temporaries, rt.Stack, rt.Args);
+                     rt.Globals + rt.Slack, rt.Temporaries, rt.Stack, rt.Args);
 }
 
 
@@ -281,44 +325,289 @@ runtime::gcptr::~gcptr()
 // ----------------------------------------------------------------------------
 //   Destructor for a garbage-collected pointer
 // ----------------------------------------------------------------------------
+//   The list is doubly linked, so that unlinking does not depend on
+//   pointers being destroyed in the reverse order of their creation
 {
-    gcptr *last = nullptr;
-    if (this == rt.GCSafe)
-    {
+    if (prev)
+        prev->next = next;
+    else
         rt.GCSafe = next;
-        return;
+    if (next)
+        next->prev = prev;
+    rt.GCSafeCount--;
+}
+
+
+template <typename Visit>
+void runtime::gc_roots(Visit visit)
+// ----------------------------------------------------------------------------
+//   Enumerate all the pointers that may keep a temporary alive
+// ----------------------------------------------------------------------------
+//   The second argument indicates that the pointer also keeps alive an
+//   object that ends exactly where it points (e.g. gcutf8 at end of text)
+{
+    for (object_p *s = Stack; s < HighMem; s++)
+        visit((byte_p *) s, false);
+    for (gcptr *p = GCSafe; p; p = p->next)
+        visit((byte_p *) &p->safe, true);
+
+    visit(&Error, false);
+    visit(&ErrorSave, false);
+    visit(&ErrorSource, false);
+    visit((byte_p *) &ErrorCommand, false);
+    visit(&ui.command, false);
+
+    utf8 *label = (utf8 *) &ui.menu_label[0][0];
+    for (uint l = 0; l < ui.NUM_MENUS; l++)
+        visit(&label[l], false);
+}
+
+
+bool runtime::gc_referenced(object_p obj, object_p next)
+// ----------------------------------------------------------------------------
+//   Check if some root points inside the given object
+// ----------------------------------------------------------------------------
+//   This is only used when the root table does not cover the object
+{
+    byte_p start = byte_p(obj);
+    byte_p end   = byte_p(next);
+    bool   found = false;
+    gc_roots([&](byte_p *slot, bool inclusive)
+    {
+        byte_p ptr = *slot;
+        if (ptr >= start && (ptr < end || (inclusive && ptr == end)))
+            found = true;
+    });
+    return found;
+}
+
+
+void runtime::gc_relocate(object_p obj, object_p next, int delta)
+// ----------------------------------------------------------------------------
+//   Adjust all the roots pointing inside an object that was moved
+// ----------------------------------------------------------------------------
+//   This is only used when the root table does not cover the object
+{
+    byte_p start = byte_p(obj);
+    byte_p end   = byte_p(next);
+    gc_roots([&](byte_p *slot, bool)
+    {
+        byte_p ptr = *slot;
+        if (ptr >= start && ptr < end)
+        {
+            record(gc_details, "Adjusting root %p from %p to %p",
+                   slot, ptr, ptr + delta);
+            *slot = ptr + delta;
+            GCStatistics.fixups++;
+        }
+    });
+}
+
+
+// The root table contains the addresses of the root pointers
+// The low bit is set for pointers that are inclusive (GC-safe pointers)
+typedef uintptr_t gc_root;
+
+static inline byte_p *gc_slot(gc_root root)
+// ----------------------------------------------------------------------------
+//   Return the address of the pointer for a root table entry
+// ----------------------------------------------------------------------------
+{
+    return (byte_p *) (root & ~uintptr_t(1));
+}
+
+
+static inline byte_p gc_value(gc_root root)
+// ----------------------------------------------------------------------------
+//   Return the current value of the pointer for a root table entry
+// ----------------------------------------------------------------------------
+{
+    return *gc_slot(root);
+}
+
+
+static inline bool gc_inclusive(gc_root root)
+// ----------------------------------------------------------------------------
+//   Check if a root table entry also keeps alive objects ending there
+// ----------------------------------------------------------------------------
+{
+    return root & 1;
+}
+
+
+static void gc_heap_up(gc_root *heap, size_t pos)
+// ----------------------------------------------------------------------------
+//   Move an entry up in a max-heap of root table entries
+// ----------------------------------------------------------------------------
+{
+    while (pos)
+    {
+        size_t parent = (pos - 1) / 2;
+        if (gc_value(heap[parent]) >= gc_value(heap[pos]))
+            break;
+        gc_root tmp = heap[parent];
+        heap[parent] = heap[pos];
+        heap[pos] = tmp;
+        pos = parent;
     }
+}
 
-    for (gcptr *gc = rt.GCSafe; gc; gc = gc->next)
+
+static void gc_heap_down(gc_root *heap, size_t pos, size_t count)
+// ----------------------------------------------------------------------------
+//   Move an entry down in a max-heap of root table entries
+// ----------------------------------------------------------------------------
+{
+    while (true)
     {
-        if (gc == this)
+        size_t child = 2 * pos + 1;
+        if (child >= count)
+            break;
+        if (child + 1 < count &&
+            gc_value(heap[child + 1]) > gc_value(heap[child]))
+            child++;
+        if (gc_value(heap[child]) <= gc_value(heap[pos]))
+            break;
+        gc_root tmp = heap[child];
+        heap[child] = heap[pos];
+        heap[pos] = tmp;
+        pos = child;
+    }
+}
+
+
+static size_t gc_adjust(gc_root *table, size_t count,
+                        object_p obj, object_p next, int delta)
+// ----------------------------------------------------------------------------
+//   Adjust the roots from a sorted table that point inside a moved object
+// ----------------------------------------------------------------------------
+//   Roots pointing inside the object are contiguous in the table, and once
+//   adjusted, they point below the object and are skipped by the merge pass.
+//   Like runtime::move(), we leave alone pointers to the end of the object,
+//   since they also point to the next object, which will be scanned next.
+{
+    size_t adjusted = 0;
+    for (size_t r = 0; r < count; r++)
+    {
+        byte_p ptr = gc_value(table[r]);
+        if (ptr >= byte_p(next))
+            break;
+        if (ptr >= byte_p(obj))
         {
-            last->next = gc->next;
-            return;
+            record(gc_details, "Adjusting root %p from %p to %p",
+                   gc_slot(table[r]), ptr, ptr + delta);
+            *gc_slot(table[r]) = ptr + delta;
+            adjusted++;
         }
-        last = gc;
     }
+    return adjusted;
+}
+
+
+static void gc_heap_sort(gc_root *heap, size_t count)
+// ----------------------------------------------------------------------------
+//   Sort a max-heap of root table entries in increasing address order
+// ----------------------------------------------------------------------------
+{
+    while (count > 1)
+    {
+        count--;
+        gc_root tmp = heap[0];
+        heap[0] = heap[count];
+        heap[count] = tmp;
+        gc_heap_down(heap, 0, count);
+    }
+}
+
+
+static void gc_filler(object_p at, size_t size)
+// ----------------------------------------------------------------------------
+//   Fill a hole left in temporaries by an incremental collection step
+// ----------------------------------------------------------------------------
+//   The hole becomes an unreferenced text, so that objects can still be
+//   walked, and it is recycled by the next step. A text cannot fill some
+//   sizes exactly, the remaining byte is filled with a one-byte command.
+{
+    byte *p   = (byte *) at;
+    byte *end = p + size;
+    if (size >= 2)
+    {
+        size_t len = size - 2;
+        while (len && 1 + leb128size(len) + len > size)
+            len--;
+        p = leb128(p, object::ID_text);
+        p = leb128(p, len);
+        p += len;
+    }
+    while (p < end)
+        *p++ = object::ID_Drop;
 }
 
 
-size_t runtime::gc()
+size_t runtime::gc(bool minor, size_t budget)
 // ----------------------------------------------------------------------------
 //   Recycle unused temporaries
 // ----------------------------------------------------------------------------
 //   Temporaries can only be referenced from the stack
 //   Objects in the global area are copied there, so they need no recycling
-//   This algorithm is linear in number of objects and moves only live data
+//
+//   Most temporaries die shortly after having been created, so a minor
+//   collection only scans the nursery, i.e. objects allocated since the
+//   last collection. Survivors are promoted by moving the nursery start
+//   to the end of temporaries, so that long-lived objects such as large
+//   lists or graphics are not copied again until the next full collection.
+//
+//   Roots (stack, return stack, locals, GC-safe pointers, errors, menus)
+//   that point into the temporaries are first gathered in a table sorted by
+//   address, which is stored in the free space above the scratchpad.
+//   Objects are then marked with a single merge pass against that table,
+//   so that the cost is linear in objects plus roots instead of their
+//   product. When free memory cannot hold all the roots, the table holds
+//   the lowest ones, and we iterate over successive address windows.
+//
+//   Live objects are compacted with a plain memmove, and the roots that
+//   point inside them, which are contiguous in the sorted table, are then
+//   adjusted in place. This way, each root is fixed exactly once, instead
+//   of rescanning all roots for every object as runtime::move() does.
+//
+//   A full collection also trims the slack after globals if it is larger
+//   than what we would reserve given the amount of free memory.
+//
+//   A non-zero budget runs one step of an incremental minor collection,
+//   used while the calculator is idle. Only the objects in the first
+//   budget bytes of the nursery are scanned and compacted. The hole they
+//   leave is filled with a garbage object, and the nursery then starts at
+//   that hole, so that the next step recycles it and resumes there. This
+//   way, a step only moves the objects it scanned. The rest of memory is
+//   only shifted down once the last step reaches the end of temporaries.
+//   Steps do not show the busy glyph, and only the last step counts as a
+//   collection in the statistics.
 {
     size_t   recycled = 0;
-    object_p first    = (object_p) Globals;
+    size_t   keep     = 1 + slack_reserve(0);
+    size_t   trim     = !minor && !budget && Slack > keep ? Slack - keep : 0;
+    object_p first    = minor ? Nursery : Globals + Slack;
     object_p last     = Temporaries;
-    object_p free     = first;
+    object_p free     = first - trim;
     object_p next;
+    uint     start    = sys_current_ms();
+    bool     boundary = false;
 
-    ui.draw_busy(L'●');
+    if (budget)
+    {
+        for (last = first; last < Temporaries; last = last->skip())
+            if (size_t(last - first) >= budget)
+                break;
+    }
+    else
+    {
+        ui.draw_busy(L'●');
+    }
 
-    record(gc, "Garbage collection, available %u, range %p-%p",
-           available(), first, last);
+    record(gc, "%+s garbage collection, available %u, range %p-%p, "
+           "%u GC-safe pointers (peak %u)",
+           minor ? "Minor" : "Full",
+           available(), first, last, GCSafeCount, GCSafePeak);
 #ifdef SIMULATOR
     if (!integrity_test(first, last, Stack, CallStack))
     {
@@ -334,77 +623,145 @@ size_t runtime::gc()
                          first, last, Stack, CallStack);
 #endif // SIMULATOR
 
-    object_p *firstobjptr = Stack;
-    object_p *lastobjptr = HighMem;
+    // The root table lives in free memory, leaving one byte after scratchpad
+    uintptr_t tstart = uintptr_t(scratchpad() + 1);
+    tstart = (tstart + sizeof(gc_root) - 1) & ~uintptr_t(sizeof(gc_root) - 1);
+    gc_root  *table    = (gc_root *) tstart;
+    size_t    capacity = tstart < uintptr_t(Stack)
+        ? (gc_root *) Stack - table
+        : 0;
 
-    for (object_p obj = first; obj < last; obj = next)
+    object_p obj = first;
+    while (obj < last)
     {
-        bool found = false;
-        next = obj->skip();
-        record(gc_details, "Scanning object %p (ends at %p)", obj, next);
-        for (object_p *s = firstobjptr; s < lastobjptr && !found; s++)
+        // Collect the lowest roots pointing at or above obj in a max-heap
+        byte_p lo    = byte_p(obj);
+        byte_p hi    = byte_p(last);
+        size_t count = 0;
+        size_t total = 0;
+        gc_roots([&](byte_p *slot, bool inclusive)
         {
-            found = *s >= obj && *s < next;
-            if (found)
-                record(gc_details, "Found %p at stack level %u",
-                       obj, s - firstobjptr);
-        }
-        if (!found)
-        {
-            for (gcptr *p = GCSafe; p && !found; p = p->next)
+            byte_p ptr = *slot;
+            if (ptr < lo || ptr > hi || (ptr == hi && !inclusive))
+                return;
+            if (ptr == byte_p(last))
+                boundary = true;
+            total++;
+            gc_root root = gc_root(slot) | inclusive;
+            if (count < capacity)
             {
-                found = p->safe >= (byte *) obj && p->safe <= (byte *) next;
-                if (found)
-                    record(gc_details, "Found %p in GC-safe pointer %p (%p)",
-                           obj, p->safe, p);
+                table[count] = root;
+                gc_heap_up(table, count++);
             }
-        }
-        if (!found)
+            else if (capacity && ptr < gc_value(table[0]))
+            {
+                table[0] = root;
+                gc_heap_down(table, 0, count);
+            }
+        });
+        gc_heap_sort(table, count);
+
+        // If the table is not complete, it only covers objects below limit
+        bool   complete = count == total;
+        byte_p limit    = count ? gc_value(table[count - 1]) : nullptr;
+        size_t cursor   = 0;
+        bool   initial  = true;
+        record(gc_details, "Root table %u entries out of %u at %p, limit %p",
+               count, total, obj, limit);
+
+        for (; obj < last; obj = next)
         {
-            // Check if some of the error information was user-supplied
-            utf8 start = utf8(obj);
-            utf8 end = utf8(next);
-            found = (Error         >= start && Error         < end)
-                ||  (ErrorSave     >= start && ErrorSave     < end)
-                ||  (ErrorSource   >= start && ErrorSource   < end)
-                ||  (ErrorCommand  >= obj   && ErrorCommand  < next)
-                ||  (ui.command    >= start && ui.command    < end);
-            if (!found)
+            bool found = false;
+            next = obj->skip();
+            record(gc_details, "Scanning object %p (ends at %p)", obj, next);
+
+            bool covered = complete || byte_p(next) < limit;
+            if (covered)
             {
-                utf8 *label = (utf8 *) &ui.menu_label[0][0];
-                for (uint l = 0; !found && l < ui.NUM_MENUS; l++)
-                    found = label[l] >= start && label[l] < end;
+                // Merge pass: skip roots below object, check for roots inside
+                while (cursor < count && gc_value(table[cursor]) < byte_p(obj))
+                    cursor++;
+                for (size_t r = cursor; r < count && !found; r++)
+                {
+                    byte_p ptr = gc_value(table[r]);
+                    if (ptr > byte_p(next))
+                        break;
+                    if (ptr >= byte_p(obj))
+                        found = ptr < byte_p(next) || gc_inclusive(table[r]);
+                }
             }
-        }
+            else if (initial)
+            {
+                // Object not fully covered by the table: check it directly
+                found = gc_referenced(obj, next);
+            }
+            else
+            {
+                // Rebuild the root table starting at this object
+                break;
+            }
+            initial = false;
 
-        if (found)
-        {
-            // Move object to free space
-            record(gc_details, "Moving %p-%p to %p", obj, next, free);
-            move(free, obj, next - obj);
-            free += next - obj;
+            if (found)
+            {
+                // Move object to free space
+                record(gc_details, "Moving %p-%p to %p", obj, next, free);
+                size_t size = next - obj;
+                if (free != obj)
+                {
+                    memmove((byte *) free, (byte *) obj, size);
+                    GCStatistics.moved += size;
+                    if (covered)
+                        GCStatistics.fixups +=
+                            gc_adjust(table + cursor, count - cursor,
+                                      obj, next, free - obj);
+                    else
+                        gc_relocate(obj, next, free - obj);
+                }
+                free += size;
+            }
+            else
+            {
+                recycled += next - obj;
+                record(gc_details, "Recycling %p size %u total %u",
+                       obj, next - obj, recycled);
+            }
         }
-        else
+    }
+
+    // A pointer to the end of the window may point to the end of the last
+    // object we moved, so in that case, shift the rest like a full step
+    size_t purged = recycled + trim;
+    bool   done   = !budget || last == Temporaries || boundary;
+    if (!done)
+    {
+        // Intermediate step: fill the hole, resume there on the next step
+        if (purged)
         {
-            recycled += next - obj;
-            record(gc_details, "Recycling %p size %u total %u",
-                   obj, next - obj, recycled);
+            gc_filler(free, purged);
+            globals_changed();
         }
+        Nursery = free;
+        purged = 0;
     }
-
-    // Move the command line and scratch buffer
-    if (Editing + Scratch)
+    else
     {
-        object_p edit = Temporaries;
-        move(edit - recycled, edit, Editing + Scratch, 1, true);
+        // Move the rest of the nursery, the command line and scratch buffer
+        size_t rest = (Temporaries - last) + Editing + Scratch;
+        if (rest)
+            move(last - purged, last, rest, 1, last == Temporaries);
+
+        // Adjust Temporaries, and promote survivors out of the nursery
+        if (purged)
+            globals_changed();
+        Temporaries -= purged;
+        Nursery = last - purged;
+        Slack -= trim;
     }
 
-    // Adjust Temporaries
-    Temporaries -= recycled;
-
 
 #ifdef SIMULATOR
-    if (!integrity_test(Globals, Temporaries, Stack, CallStack))
+    if (!integrity_test(Globals + Slack, Temporaries, Stack, CallStack))
     {
         record(gc_errors, "Integrity test failed post-collection");
         RECORDER_TRACE(gc) = 2;
@@ -414,15 +771,48 @@ size_t runtime::gc()
     }
     if (RECORDER_TRACE(gc) > 1)
         dump_object_list("Post-collection",
-                         (object_p) Globals, Temporaries,
+                         Globals + Slack, Temporaries,
                          Stack, CallStack);
 #endif // SIMULATOR
 
-    record(gc, "Garbage collection done, purged %u, available %u",
-           recycled, available());
+    record(gc, "Garbage collection done, purged %u, slack %u, available %u",
+           purged, Slack, available());
+
+    // Update statistics
+    uint pause = sys_current_ms() - start;
+    bool whole = !budget || Nursery == Temporaries;
+    GCStatistics.collections += whole;
+    GCStatistics.minor += minor && whole;
+    GCStatistics.recycled += purged;
+    if (GCStatistics.pause < pause)
+        GCStatistics.pause = pause;
+
+    if (!budget)
+        ui.draw_busy();
+    return purged;
+}
+
 
-    ui.draw_busy();
-    return recycled;
+void runtime::gc_reset_statistics()
+// ----------------------------------------------------------------------------
+//   Reset garbage collection and allocation statistics
+// ----------------------------------------------------------------------------
+{
+    GCStatistics = gcstats();
+    GCSafePeak = GCSafeCount;
+#if CONFIG_GC_ALLOCATIONS
+    memset(GCAllocated, 0, sizeof(GCAllocated));
+#endif // CONFIG_GC_ALLOCATIONS
+}
+
+
+void runtime::gc_allocated(object_p obj, size_t size)
+// ----------------------------------------------------------------------------
+//   Record the allocation of an object built in the scratchpad
+// ----------------------------------------------------------------------------
+{
+    if (size)
+        gc_allocated(obj->type(), size);
 }
 
 
@@ -450,6 +840,7 @@ void runtime::move(object_p to, object_p from,
 
     // Move the object in memory
     memmove((byte *) to, (byte *) from, size);
+    GCStatistics.moved += size;
 
     // Adjust the protected pointers
     object_p last = from + size + overscan;
@@ -462,6 +853,7 @@ void runtime::move(object_p to, object_p from,
             record(gc_details, "Adjusting GC-safe %p from %p to %p",
                    p, p->safe, p->safe + delta);
             p->safe += delta;
+            GCStatistics.fixups++;
         }
     }
 
@@ -479,6 +871,7 @@ void runtime::move(object_p to, object_p from,
             record(gc_details, "Adjusting stack level %u from %p to %p",
                    s - firstobjptr, *s, *s + delta);
             *s += delta;
+            GCStatistics.fixups++;
         }
     }
 
@@ -508,19 +901,108 @@ void runtime::move_globals(object_p to, object_p from)
 // ----------------------------------------------------------------------------
 //    Move data in the globals area
 // ----------------------------------------------------------------------------
-//    In that case, we need to move everything up to the scratchpad
+//    There is some slack between globals and temporaries, so that storing
+//    a global usually only shifts the globals above the storage location.
+//    When there is not enough slack, we need to move everything up to the
+//    scratchpad, and we take this opportunity to reserve additional slack.
+//    There is always at least one byte of slack, so that a pointer to the
+//    end of the globals is never confused with one to the first temporary.
+//    Callers check that delta bytes are available, which, since there is at
+//    least one byte of slack, covers what we need. The additional reserve
+//    is only taken from what remains available after that.
+//    When globals shrink, the slack grows. If it becomes much larger than
+//    what we would reserve, the excess is returned to temporaries.
 {
-    // We overscan by 1 to deal with gcp that point to end of objects
-    object_p last = (object_p) scratchpad() + allocated();
-    object_p first = to < from ? to : from;
-    size_t moving = last - first;
-    move(to, from, moving, 1);
-
-    // Adjust Globals and Temporaries (for Temporaries, must be <=, not <)
     int delta = to - from;
-    if (Globals >= first && Globals < last)             // Storing global var
-        Globals += delta;
-    Temporaries += delta;
+    if (delta >= int(Slack))
+    {
+        // Move temporaries, editor and scratchpad to make room
+        // We overscan by 1 to deal with gcp that point to end of objects
+        size_t   needed  = delta - Slack + 1;
+        size_t   grow    = needed + slack_reserve(needed);
+        object_p first   = Globals + Slack;
+        object_p last    = (object_p) scratchpad() + allocated();
+        record(gc, "Growing slack by %u to store %u bytes", grow, delta);
+        move(first + grow, first, last - first, 1);
+        Temporaries += grow;
+        Nursery += grow;
+        Slack += grow;
+    }
+
+    // Shift the globals above the storage location within the slack
+    directories_changed();
+    move(to, from, Globals - from, 1);
+    Globals += delta;
+    Slack -= delta;
+
+    // Do not keep too much free memory hidden in the slack
+    if (delta < 0)
+    {
+        size_t keep = 1 + slack_reserve(0);
+        if (Slack > 2 * keep)
+            trim_slack(keep);
+    }
+}
+
+
+size_t runtime::slack_reserve(size_t needed)
+// ----------------------------------------------------------------------------
+//   Compute the slack we want to reserve after globals
+// ----------------------------------------------------------------------------
+//   This is a fraction of what remains available once we have what is needed,
+//   in addition to the one byte of slack that we always keep. It never
+//   exceeds what remains available, and may be zero.
+{
+    size_t avail   = available();
+    size_t reserve = avail > needed ? (avail - needed) / 8 : 0;
+    if (reserve > slack_max)
+        reserve = slack_max;
+    return reserve;
+}
+
+
+void runtime::release_slack()
+// ----------------------------------------------------------------------------
+//   Release the slack after globals when we are running out of memory
+// ----------------------------------------------------------------------------
+{
+    trim_slack(1);
+}
+
+
+void runtime::trim_slack(size_t keep)
+// ----------------------------------------------------------------------------
+//   Return slack after globals to temporaries, keeping the given size
+// ----------------------------------------------------------------------------
+{
+    size_t   trim  = Slack - keep;
+    object_p first = Globals + Slack;
+    object_p last  = (object_p) scratchpad() + allocated();
+    record(gc, "Releasing %u bytes of slack", trim);
+    globals_changed();
+    move(first - trim, first, last - first, 1);
+    Temporaries -= trim;
+    Nursery -= trim;
+    Slack -= trim;
+}
+
+
+byte *runtime::home_image(size_t size)
+// ----------------------------------------------------------------------------
+//   Make room to read a home directory of the given size in place
+// ----------------------------------------------------------------------------
+//   This is used to load a binary snapshot of the global variables.
+//   The image replaces the current home directory, so the path must only
+//   contain the home directory. The caller must write a valid directory of
+//   the given size at the returned address, or reset the runtime.
+{
+    size_t current = (byte *) Globals - (byte *) LowMem;
+    if (directories() != 1)
+        return nullptr;
+    if (size > current && available(size - current) < size - current)
+        return nullptr;
+    move_globals(object_p((byte *) LowMem + size), Globals);
+    return (byte *) LowMem;
 }
 
 #ifdef DM42
@@ -699,6 +1181,23 @@ byte *runtime::append(size_t sz, gcbytes bytes)
 }
 
 
+byte *runtime::reserve(size_t &sz)
+// ----------------------------------------------------------------------------
+//   Make room for up to 'sz' bytes at end of scratchpad
+// ----------------------------------------------------------------------------
+//   This lets readers fill the scratchpad in large chunks, e.g. directly
+//   from a file, then commit what they actually read with allocate().
+//   Unlike allocate(), running short of memory is not an error here.
+{
+    size_t avail = available();
+    if (avail < sz)
+        avail = reclaim(sz);
+    if (sz > avail)
+        sz = avail;
+    return editor() + Editing + Scratch;
+}
+
+
 object_p runtime::clone(object_p source)
 // ----------------------------------------------------------------------------
 //   Clone an object into the temporaries area
@@ -712,13 +1211,14 @@ object_p runtime::clone(object_p source)
     Temporaries = object_p((byte *) Temporaries + size);
     move(Temporaries, result, Editing + Scratch, 1, true);
     memmove((void *) result, source, size);
+    gc_allocated(result, size);
     return result;
 }
 
 
 object_p runtime::clone_global(object_p global)
 // ----------------------------------------------------------------------------
-//   Check if any entry in the stack points to a given global, if so clone it
+//   Check if any entry in the stack or locals points to a global, clone it
 // ----------------------------------------------------------------------------
 {
     object_p cloned = nullptr;
@@ -733,6 +1233,20 @@ object_p runtime::clone_global(object_p global)
             *s = cloned;
         }
     }
+    for (object_p *frame = LocalFrames; frame; frame = (object_p *) frame[0])
+    {
+        begin = frame + 2;
+        end = begin + size_t(frame[1]);
+        for (object_p *s = begin; s < end; s++)
+        {
+            if (*s == global)
+            {
+                if (!cloned)
+                    cloned = clone(global);
+                *s = cloned;
+            }
+        }
+    }
     return cloned;
 }
 
@@ -859,6 +1373,7 @@ bool runtime::top(object_p obj)
         missing_argument_error();
         return false;
     }
+    journal(depth() - 1);
     *Stack = obj;
     return true;
 }
@@ -874,6 +1389,7 @@ object_p runtime::pop()
         missing_argument_error();
         return nullptr;
     }
+    journal(depth() - 1);
     return *Stack++;
 }
 
@@ -902,6 +1418,7 @@ bool runtime::stack(uint idx, object_p obj)
         missing_argument_error();
         return false;
     }
+    journal(depth() - 1 - idx);
     Stack[idx] = obj;
     return true;
 }
@@ -920,6 +1437,7 @@ bool runtime::roll(uint idx)
             missing_argument_error();
             return false;
         }
+        journal(depth() - 1 - idx);
         object_p s = Stack[idx];
         memmove(Stack + 1, Stack, idx * sizeof(*Stack));
         *Stack = s;
@@ -941,6 +1459,7 @@ bool runtime::rolld(uint idx)
             missing_argument_error();
             return false;
         }
+        journal(depth() - 1 - idx);
         object_p s = *Stack;
         memmove(Stack, Stack + 1, idx * sizeof(*Stack));
         Stack[idx] = s;
@@ -959,6 +1478,7 @@ bool runtime::drop(uint count)
         missing_argument_error();
         return false;
     }
+    journal(depth() - count);
     Stack += count;
     return true;
 }
@@ -1040,27 +1560,79 @@ bool runtime::last(uint index)
 
 bool runtime::save()
 // ----------------------------------------------------------------------------
-//   Save the stack in the undo area
+//   Save the stack for undo
 // ----------------------------------------------------------------------------
+//   Rather than copying the whole stack, only remember its depth.
+//   Levels that are later overwritten or consumed are first copied into
+//   the undo journal by journal_levels(), so the cost of saving depends on
+//   what commands change, not on the depth of the stack.
 {
-    size_t scount = depth();
-    size_t ucount = saved();
-    if (scount > ucount)
+    size_t depth = this->depth();
+    size_t used  = UndoDepth - UndoBase;
+    for (size_t i = 0; i < used; i++)
+        Undo[i] = nullptr;
+    UndoDepth = depth;
+    UndoBase = depth;
+
+    // Give back journal space if the stack shrunk a lot since we grew it
+    size_t capacity = Directories - Undo;
+    if (capacity > 2 * depth)
     {
-        size_t sz = (scount - ucount) * sizeof(object_p);
-        if (available(sz) < sz)
-            return false;
+        memmove(Stack + capacity, Stack, (Undo - Stack) * sizeof(object_p));
+        Stack += capacity;
+        Args += capacity;
+        Undo += capacity;
     }
+    return true;
+}
+
+
+bool runtime::journal_levels(size_t keep)
+// ----------------------------------------------------------------------------
+//   Copy the levels between 'keep' and UndoBase into the undo journal
+// ----------------------------------------------------------------------------
+//   Levels are counted from the bottom of the stack, i.e. from Args.
+//   The journal holds the levels that changed since the last save(),
+//   top-most first, so that undo() can copy it back in one block.
+{
+    size_t base     = UndoBase;
+    size_t used     = UndoDepth - base;
+    size_t needed   = UndoDepth - keep;
+    size_t capacity = Directories - Undo;
+    if (needed > capacity)
+    {
+        // Grow geometrically, but never beyond the saved depth
+        size_t grow = 2 * capacity;
+        if (grow < needed)
+            grow = needed;
+        if (grow > UndoDepth)
+            grow = UndoDepth;
+        size_t delta = grow - capacity;
+        size_t sz    = delta * sizeof(object_p);
+
+        // Do not garbage collect here, callers may hold unprotected pointers
+        if (available() < sz)
+        {
+            record(runtime_error,
+                   "Dropping undo state, cannot journal %u levels", needed);
+            for (size_t i = 0; i < used; i++)
+                Undo[i] = nullptr;
+            UndoDepth = 0;
+            UndoBase = 0;
+            return false;
+        }
 
-    object_p *ns = Stack + ucount - scount;
-    ASSERT(ns + (Undo - Stack) < HighMem);
-    ASSERT(Stack + depth() < HighMem);
-    memmove(ns, Stack, (Undo - Stack) * sizeof(object_p));
-    Stack = ns;
-    Args = Args + ucount - scount;
-    Undo = Undo + ucount - scount;
-    memmove(Undo, Stack, depth() * sizeof(object_p));
+        size_t moving = Undo + used - Stack;
+        memmove(Stack - delta, Stack, moving * sizeof(object_p));
+        Stack -= delta;
+        Args -= delta;
+        Undo -= delta;
+        for (size_t i = used; i < used + delta; i++)
+            Undo[i] = nullptr;
+    }
 
+    memcpy(Undo + used, Args - base, (base - keep) * sizeof(object_p));
+    UndoBase = keep;
     return true;
 }
 
@@ -1069,8 +1641,9 @@ bool runtime::undo()
 // ----------------------------------------------------------------------------
 //   Revert the stack to what it was before
 // ----------------------------------------------------------------------------
+//   Levels below UndoBase were not changed, only the journal is copied back
 {
-    size_t ucount = saved();
+    size_t ucount = UndoDepth;
     size_t scount = depth();
     if (ucount > scount)
     {
@@ -1079,8 +1652,8 @@ bool runtime::undo()
             return false;
     }
 
-    Stack = Stack + scount - ucount;
-    memmove(Stack, Undo, ucount * sizeof(object_p));
+    Stack = Args - ucount;
+    memmove(Stack, Undo, (ucount - UndoBase) * sizeof(object_p));
 
     return true;
 }
@@ -1103,18 +1676,40 @@ runtime &runtime::command(object_p cmd)
 //
 // ============================================================================
 
-object_p runtime::local(uint index)
+//   Locals live in frames on the return stack, so that entering or leaving
+//   a locals block does not move the user stack. A frame is laid out as:
+//   - Pointer to the enclosing frame, or nullptr
+//   - Number of locals in the frame
+//   - Local 0, local 1, ..., padded to an even number of entries
+//   Frames are only pushed and popped at the top of the return stack, by
+//   locals() and unlocals(). Indexes count from the innermost frame outwards,
+//   as if all frames were contiguous.
+
+object_p *runtime::local_slot(uint index)
 // ----------------------------------------------------------------------------
-//   Fetch local at given index
+//   Find the slot for a local at given index
 // ----------------------------------------------------------------------------
 {
-    size_t count = Directories - Locals;
-    if (index >= count)
+    for (object_p *frame = LocalFrames; frame; frame = (object_p *) frame[0])
     {
-        invalid_local_error();
-        return nullptr;
+        size_t count = size_t(frame[1]);
+        if (index < count)
+            return frame + 2 + index;
+        index -= count;
     }
-    return Locals[index];
+    invalid_local_error();
+    return nullptr;
+}
+
+
+object_p runtime::local(uint index)
+// ----------------------------------------------------------------------------
+//   Fetch local at given index
+// ----------------------------------------------------------------------------
+{
+    if (object_p *slot = local_slot(index))
+        return *slot;
+    return nullptr;
 }
 
 
@@ -1123,14 +1718,12 @@ bool runtime::local(uint index, object_p obj)
 //   Set a local in the local stack
 // ----------------------------------------------------------------------------
 {
-    size_t count = Directories - Locals;
-    if (index >= count)
+    if (object_p *slot = local_slot(index))
     {
-        invalid_local_error();
-        return false;
+        *slot = obj;
+        return true;
     }
-    Locals[index] = obj;
-    return true;
+    return false;
 }
 
 
@@ -1145,26 +1738,48 @@ bool runtime::locals(size_t count)
         missing_argument_error();
         return false;
     }
+    if (!count)
+        return true;
 
-    // Check if we have the memory
-    size_t req = count * sizeof(void *);
-    if (available(req) < req)
+    // Push values two at a time, may grow the call stack and move the stack
+    // In `→ X Y « X Y - X Y +`, X is level 1 of the stack, Y is level 0
+    size_t slots = (count + 1) & ~size_t(1);
+    for (size_t var = slots; var > 0; var -= 2)
+    {
+        object_p first  = Stack[count - (var - 1)];
+        object_p second = var <= count ? Stack[count - var] : nullptr;
+        if (!run_push_data(first, second))
+        {
+            drop_frame(slots - var);
+            return false;
+        }
+    }
+    if (!run_push_data(object_p(LocalFrames), object_p(count)))
+    {
+        drop_frame(slots);
         return false;
+    }
+    LocalFrames = Returns;
+    LocalCount += count;
 
-    // Move pointers down
-    Stack -= count;
-    Args -= count;
-    Undo -= count;
-    Locals -= count;
-    size_t moving = Locals - Stack;
-    for (size_t i = 0; i < moving; i++)
-        Stack[i] = Stack[i + count];
+    // The top levels are consumed
+    journal(depth() - count);
+    Stack += count;
+    return true;
+}
 
-    // In `→ X Y « X Y - X Y +`, X is level 1 of the stack, Y is level 0
-    for (size_t var = 0; var < count; var++)
-        Locals[count - 1 - var] = *Stack++;
 
-    return true;
+void runtime::drop_frame(size_t entries)
+// ----------------------------------------------------------------------------
+//   Drop entries pushed on the return stack, an even number
+// ----------------------------------------------------------------------------
+{
+    for (size_t e = 0; e < entries; e += 2)
+    {
+        Returns += 2;
+        if ((HighMem - Returns) % CALLS_BLOCK == 0)
+            call_stack_drop();
+    }
 }
 
 
@@ -1172,26 +1787,23 @@ bool runtime::unlocals(size_t count)
 // ----------------------------------------------------------------------------
 //    Free the given number of locals
 // ----------------------------------------------------------------------------
+//   The frames being freed must be at the top of the return stack
 {
-    if (count)
+    while (count)
     {
         // Sanity check on what we remove
-        if (count > size_t(Directories - Locals))
+        object_p *frame = LocalFrames;
+        size_t    size  = frame ? size_t(frame[1]) : 0;
+        if (frame != Returns || !size || size > count)
         {
             invalid_local_error();
             return false;
         }
 
-        // Move pointers up
-        object_p *oldp = Locals;
-        Stack += count;
-        Args += count;
-        Undo += count;
-        Locals += count;
-        object_p *newp = Locals;
-        size_t moving = Locals - Stack;
-        for (size_t i = 0; i < moving; i++)
-            *(--newp) = *(--oldp);
+        LocalFrames = (object_p *) frame[0];
+        LocalCount -= size;
+        count -= size;
+        drop_frame(2 + ((size + 1) & ~size_t(1)));
     }
 
     return true;
@@ -1218,7 +1830,6 @@ bool runtime::enter(directory_p dir)
     Stack--;
     Args--;
     Undo--;
-    Locals--;
     Directories--;
 
     size_t moving = Directories - Stack;
@@ -1227,6 +1838,7 @@ bool runtime::enter(directory_p dir)
 
     // Update directory
     *Directories = dir;
+    globals_changed();
 
     return true;
 }
@@ -1248,13 +1860,13 @@ bool runtime::updir(size_t count)
     Stack += count;
     Args += count;
     Undo += count;
-    Locals += count;
     Directories += count;
 
     object_p *newp = Directories;
     size_t moving = Directories - Stack;
     for (size_t i = 0; i < moving; i++)
         *(--newp) = *(--oldp);
+    globals_changed();
 
     return true;
 }
@@ -1351,6 +1963,23 @@ bool runtime::run_select_while(bool condition)
 }
 
 
+static bool loop_counter(object_p obj, large &value)
+// ----------------------------------------------------------------------------
+//   Check if a loop counter, limit or step can be processed natively
+// ----------------------------------------------------------------------------
+//   We limit ourselves to 62 bits, so that adding the step cannot overflow
+{
+    object::id ty = obj->type();
+    if (ty != object::ID_integer && ty != object::ID_neg_integer)
+        return false;
+    ularge magnitude = integer_p(obj)->value<ularge>();
+    if (magnitude >> 62)
+        return false;
+    value = ty == object::ID_neg_integer ? -large(magnitude) : large(magnitude);
+    return true;
+}
+
+
 bool runtime::run_select_start_step(bool for_loop, bool has_step)
 // ----------------------------------------------------------------------------
 //   Select evaluation branches in a for loop
@@ -1366,52 +1995,81 @@ bool runtime::run_select_start_step(bool for_loop, bool has_step)
         return false;
     }
 
-    bool down = false;
-    algebraic_g step;
+    object_p stepobj = nullptr;
     if (has_step)
     {
-        object_p obj = rt.pop();
-        if (!obj)
+        stepobj = rt.pop();
+        if (!stepobj)
             return false;
-        step = obj->as_algebraic();
-        if (!step)
+    }
+
+    int   finished = 0;
+    large curv, lastv, stepv = 1;
+    if (loop_counter(Returns[0], curv) &&
+        loop_counter(Returns[1], lastv) &&
+        (!stepobj || loop_counter(stepobj, stepv)))
+    {
+        // Fast path: increment and compare natively, no temporaries,
+        // and a preallocated integer for the counter in the common case
+        curv += stepv;
+        finished = stepv < 0 ? curv < lastv : curv > lastv;
+        if (!finished)
         {
-            object::id ty = for_loop?object::ID_ForStep:object::ID_StartStep;
-            object_p cmd = command::static_object(ty);
-            rt.command(cmd).type_error();
-            return false;
+            integer_p cur = integer::make(curv);
+            if (!cur)
+                return false;
+            Returns[0] = cur;
+            if (for_loop)
+                rt.local(0, cur);
         }
-        down = step->is_negative();
     }
     else
     {
-        step = integer::make(1);
-        if (!step)
-            return false;
-    }
+        bool        down = false;
+        algebraic_g step;
+        if (stepobj)
+        {
+            step = stepobj->as_algebraic();
+            if (!step)
+            {
+                object::id ty = for_loop ? object::ID_ForStep
+                                         : object::ID_StartStep;
+                object_p cmd = command::static_object(ty);
+                rt.command(cmd).type_error();
+                return false;
+            }
+            down = step->is_negative();
+        }
+        else
+        {
+            step = integer::make(1);
+            if (!step)
+                return false;
+        }
 
-    // Increment and compare with last iteration
-    algebraic_g cur  = Returns[0]->as_algebraic();
-    algebraic_g last = Returns[1]->as_algebraic();
-    if (!cur || !last)
-    {
-        object::id ty = for_loop?object::ID_ForStep:object::ID_StartStep;
-        object_p cmd = command::static_object(ty);
-        rt.command(cmd);
-        return false;
-    }
-    cur = cur + step;
-    last = down ? (cur < last) : (cur > last);
-    Returns[0] = cur;
+        // Increment and compare with last iteration
+        algebraic_g cur  = Returns[0]->as_algebraic();
+        algebraic_g last = Returns[1]->as_algebraic();
+        if (!cur || !last)
+        {
+            object::id ty = for_loop?object::ID_ForStep:object::ID_StartStep;
+            object_p cmd = command::static_object(ty);
+            rt.command(cmd);
+            return false;
+        }
+        cur = cur + step;
+        last = down ? (cur < last) : (cur > last);
+        Returns[0] = cur;
 
-    // Write the current value in the variable if it's a for loop
-    if (for_loop)
-        rt.local(0, cur);
+        // Write the current value in the variable if it's a for loop
+        if (for_loop)
+            rt.local(0, cur);
 
-    // Check the truth value
-    int finished = last->as_truth(true);
-    if (finished < 0)
-        return false;
+        // Check the truth value
+        finished = last->as_truth(true);
+        if (finished < 0)
+            return false;
+    }
 
     if (finished)
     {
@@ -1486,7 +2144,6 @@ bool runtime::call_stack_grow(object_p &next, object_p &end)
     Stack -= CALLS_BLOCK;
     Args -= CALLS_BLOCK;
     Undo -= CALLS_BLOCK;
-    Locals -= CALLS_BLOCK;
     Directories -= CALLS_BLOCK;
     CallStack -= CALLS_BLOCK;
     next = nextg;
@@ -1503,7 +2160,6 @@ void runtime::call_stack_drop()
     Stack += CALLS_BLOCK;
     Args += CALLS_BLOCK;
     Undo += CALLS_BLOCK;
-    Locals += CALLS_BLOCK;
     Directories += CALLS_BLOCK;
     CallStack += CALLS_BLOCK;
     for (object_p *s = CallStack-1; s >= Stack; s--)
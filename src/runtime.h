@@ -34,6 +34,7 @@
 //        [Pointer to return address N]
 //        [... intermediate return addresses ...]
 //        [Pointer to return address 0]
+//        [Frames of local variables are interleaved with return addresses]
 //      Returns
 //        [... Returns reserve]
 //      CallStack
@@ -41,11 +42,8 @@
 //        [ ... intermediate directory pointers ...]
 //        [Pointer to innermost directory in path]
 //      Directories     Bottom of stack, start of global
-//        [Local N]
-//        [...]
-//        [Local 0]
-//      Locals
-//        [Last stack from command-line evaluation]
+//        [Null entries, room to grow the undo journal]
+//        [Stack levels changed since the last save, bottom-most last]
 //      Undo
 //        [Arguments to last command]
 //      Args
@@ -64,6 +62,7 @@
 //        [Text editor contents]
 //      Temporaries     Temporaries, allocated up
 //        [Previously allocated temporary objects, can be garbage collected]
+//        [Slack, to grow or shrink global objects without moving the above]
 //      Globals         End of global named RPL objects
 //        [Top-level directory of global objects]
 //      LowMem          Bottom of memory
@@ -81,6 +80,15 @@
 #include <stdio.h>
 #include <string.h>
 
+// Counting allocations for each object type takes about 5 KB of RAM
+#ifndef CONFIG_GC_ALLOCATIONS
+#  if SIMULATOR
+#    define CONFIG_GC_ALLOCATIONS       1
+#  else
+#    define CONFIG_GC_ALLOCATIONS       0
+#  endif
+#endif // CONFIG_GC_ALLOCATIONS
+
 
 struct object;                  // RPL object
 struct directory;               // Directory (storing global variables)
@@ -125,6 +133,9 @@ struct runtime
     // Amount of space we want to keep between stack top and temporaries
     const uint redzone = 2*sizeof(object_p);;
 
+    // Maximum amount of slack we reserve between globals and temporaries
+    const uint slack_max = 1024;
+
 
 
     // ========================================================================
@@ -143,6 +154,27 @@ struct runtime
     //   Check if we have enough for the given size
     // ------------------------------------------------------------------------
 
+    size_t reclaim(size_t size);
+    // ------------------------------------------------------------------------
+    //   Garbage collect to make room for the given size, return available
+    // ------------------------------------------------------------------------
+
+    size_t nursery()
+    // ------------------------------------------------------------------------
+    //   Return the size of temporaries allocated since last collection
+    // ------------------------------------------------------------------------
+    {
+        return (byte *) Temporaries - (byte *) Nursery;
+    }
+
+    size_t slack()
+    // ------------------------------------------------------------------------
+    //   Return the free space reserved after globals
+    // ------------------------------------------------------------------------
+    {
+        return Slack;
+    }
+
     template <typename Obj, typename ... Args>
     const Obj *make(typename Obj::id type, const Args &... args);
     // ------------------------------------------------------------------------
@@ -289,10 +321,98 @@ struct runtime
     //
     // ========================================================================
 
-    size_t gc();
+    size_t gc(bool minor = false, size_t budget = 0);
     // ------------------------------------------------------------------------
     //   Garbage collector (purge unused objects from memory to make space)
     // ------------------------------------------------------------------------
+    //   A minor collection only scans objects allocated since the last one
+    //   A budget limits a minor collection to that many bytes of the nursery
+
+
+    struct gcstats
+    // ------------------------------------------------------------------------
+    //   Statistics about garbage collection
+    // ------------------------------------------------------------------------
+    {
+        uint   collections;     // Number of collections
+        uint   minor;           // Number of minor collections
+        size_t recycled;        // Bytes recycled
+        size_t moved;           // Bytes moved in memory
+        size_t fixups;          // Pointers adjusted after moving objects
+        uint   pause;           // Longest collection, in milliseconds
+    };
+
+
+    const gcstats &gc_statistics()
+    // ------------------------------------------------------------------------
+    //   Return garbage collection statistics
+    // ------------------------------------------------------------------------
+    {
+        return GCStatistics;
+    }
+
+
+    uint gc_allocations(uint type)
+    // ------------------------------------------------------------------------
+    //   Return the bytes allocated for the given type
+    // ------------------------------------------------------------------------
+    {
+#if CONFIG_GC_ALLOCATIONS
+        return GCAllocated[type];
+#else
+        return 0;
+#endif // CONFIG_GC_ALLOCATIONS
+    }
+
+
+    uint gc_safe_peak()
+    // ------------------------------------------------------------------------
+    //   Return the highest number of live GC-safe pointers
+    // ------------------------------------------------------------------------
+    {
+        return GCSafePeak;
+    }
+
+
+    void gc_reset_statistics();
+    // ------------------------------------------------------------------------
+    //   Reset garbage collection and allocation statistics
+    // ------------------------------------------------------------------------
+
+
+    void gc_allocated(uint type, size_t size)
+    // ------------------------------------------------------------------------
+    //   Record the allocation of an object of the given type
+    // ------------------------------------------------------------------------
+    {
+#if CONFIG_GC_ALLOCATIONS
+        GCAllocated[type] += size;
+#endif // CONFIG_GC_ALLOCATIONS
+    }
+
+    void gc_allocated(object_p obj, size_t size);
+    // ------------------------------------------------------------------------
+    //   Record the allocation of the given object
+    // ------------------------------------------------------------------------
+
+
+    template <typename Visit>
+    void gc_roots(Visit visit);
+    // ------------------------------------------------------------------------
+    //   Call `visit(slot, inclusive)` for each pointer that keeps objects live
+    // ------------------------------------------------------------------------
+
+
+    bool gc_referenced(object_p obj, object_p next);
+    // ------------------------------------------------------------------------
+    //   Check if any root points into the given object (slow path)
+    // ------------------------------------------------------------------------
+
+
+    void gc_relocate(object_p obj, object_p next, int delta);
+    // ------------------------------------------------------------------------
+    //   Adjust the roots pointing into an object that was moved (slow path)
+    // ------------------------------------------------------------------------
 
 
     void move(object_p to, object_p from,
@@ -304,7 +424,31 @@ struct runtime
 
     void move_globals(object_p to, object_p from);
     // ------------------------------------------------------------------------
-    //    Move data in the globals area (move everything up to end of scratch)
+    //    Move data in the globals area (using slack if possible)
+    // ------------------------------------------------------------------------
+
+
+    byte *home_image(size_t size);
+    // ------------------------------------------------------------------------
+    //    Make room to read a home directory image of the given size
+    // ------------------------------------------------------------------------
+
+
+    size_t slack_reserve(size_t needed);
+    // ------------------------------------------------------------------------
+    //    Compute the slack to reserve after globals, beyond one byte
+    // ------------------------------------------------------------------------
+
+
+    void release_slack();
+    // ------------------------------------------------------------------------
+    //    Release slack after globals to make room for temporaries
+    // ------------------------------------------------------------------------
+
+
+    void trim_slack(size_t keep);
+    // ------------------------------------------------------------------------
+    //    Reduce slack after globals to the given size
     // ------------------------------------------------------------------------
 
 
@@ -313,13 +457,13 @@ struct runtime
     //   Protect a pointer against garbage collection
     // ------------------------------------------------------------------------
     {
-        gcptr(byte *ptr = nullptr) : safe(ptr), next(rt.GCSafe)
+        gcptr(byte *ptr = nullptr) : safe(ptr)
         {
-            rt.GCSafe = this;
+            link();
         }
-        gcptr(const gcptr &o): safe(o.safe), next(rt.GCSafe)
+        gcptr(const gcptr &o): safe(o.safe)
         {
-            rt.GCSafe = this;
+            link();
         }
         ~gcptr();
 
@@ -341,9 +485,22 @@ struct runtime
             return result;
         }
 
+    private:
+        void link()
+        {
+            next = rt.GCSafe;
+            prev = nullptr;
+            if (next)
+                next->prev = this;
+            rt.GCSafe = this;
+            if (++rt.GCSafeCount > rt.GCSafePeak)
+                rt.GCSafePeak = rt.GCSafeCount;
+        }
+
     private:
         byte  *safe;
         gcptr *next;
+        gcptr *prev;
 
         friend struct runtime;
     };
@@ -439,6 +596,15 @@ struct runtime
     // ------------------------------------------------------------------------
 
 
+    byte *reserve(size_t &sz);
+    // ------------------------------------------------------------------------
+    //   Make room for up to 'sz' bytes past the scratchpad without allocating
+    // ------------------------------------------------------------------------
+    //   On return, 'sz' is the number of bytes that can be written at the
+    //   returned address. They must be committed with allocate() before
+    //   anything else can allocate memory or garbage collect.
+
+
     template <typename Int>
     byte *encode(Int value);
     // ------------------------------------------------------------------------
@@ -473,6 +639,7 @@ struct runtime
         {
             object_p result = Temporaries;
             Temporaries = (object_p) ((byte *) Temporaries + Scratch);
+            gc_allocated(result, Scratch);
             Scratch = 0;
             return result;
         }
@@ -492,7 +659,89 @@ struct runtime
 #  pragma GCC optimize("-O3")
 #endif // DM42
 
-    enum { CALLS_BLOCK = 32 };
+    enum { CALLS_BLOCK = 32, RUN_CACHE = 64 };
+
+    struct run_entry
+    // ------------------------------------------------------------------------
+    //   Cached decoding of an object being run from a program
+    // ------------------------------------------------------------------------
+    {
+        object_p        object;         // Object this entry describes
+        object_p        next;           // Object following it in memory
+        uint            type;           // Decoded type of the object
+    };
+
+    static uint run_fuse(object_p obj, uint type, object_p &next);
+    // ------------------------------------------------------------------------
+    //   Decode a pair of objects that can run as one (see program.cc)
+    // ------------------------------------------------------------------------
+
+    static const run_entry &run_cached(object_p obj)
+    // ------------------------------------------------------------------------
+    //   Return the cache entry that would hold the given object
+    // ------------------------------------------------------------------------
+    {
+        return RunCache[uintptr_t(obj) % RUN_CACHE];
+    }
+
+    static void run_cache_flush()
+    // ------------------------------------------------------------------------
+    //   Invalidate the run cache when objects move in memory
+    // ------------------------------------------------------------------------
+    {
+        memset(RunCache, 0, sizeof(RunCache));
+    }
+
+    static void globals_changed()
+    // ------------------------------------------------------------------------
+    //   Invalidate caches when objects move or the directory path changes
+    // ------------------------------------------------------------------------
+    {
+        GlobalsGeneration++;
+        run_cache_flush();
+    }
+
+    static void directories_changed()
+    // ------------------------------------------------------------------------
+    //   Invalidate caches when global directories move or change
+    // ------------------------------------------------------------------------
+    {
+        DirectoriesGeneration++;
+        globals_changed();
+    }
+
+    static uint directories_generation()
+    // ------------------------------------------------------------------------
+    //   Return a counter that changes each time directories_changed() is called
+    // ------------------------------------------------------------------------
+    {
+        return DirectoriesGeneration;
+    }
+
+    static uint globals_generation()
+    // ------------------------------------------------------------------------
+    //   Return a counter that changes each time globals_changed() is called
+    // ------------------------------------------------------------------------
+    {
+        return GlobalsGeneration;
+    }
+
+    bool in_scratch(const void *ptr) const
+    // ------------------------------------------------------------------------
+    //   Check if a pointer is in the editor, the scratchpad or free memory
+    // ------------------------------------------------------------------------
+    //   Memory there can hold different objects without any object moving
+    {
+        return ptr >= (const void *) Temporaries && ptr < (const void *) Stack;
+    }
+
+    bool in_globals(const void *ptr) const
+    // ------------------------------------------------------------------------
+    //   Check if a pointer is in global objects, which a store may overwrite
+    // ------------------------------------------------------------------------
+    {
+        return ptr >= (const void *) LowMem && ptr < (const void *) Globals;
+    }
 
     bool run_push_data(object_p next, object_p end)
     // ------------------------------------------------------------------------
@@ -537,7 +786,18 @@ struct runtime
             {
                 if (next)
                 {
-                    object_p nnext = next->skip();
+                    // Objects in loops are decoded only once
+                    run_entry &cached = RunCache[uintptr_t(next) % RUN_CACHE];
+                    if (cached.object != next)
+                    {
+                        cached.object = next;
+                        cached.type   = next->type();
+                        cached.next   = next->skip();
+                        if (cached.next < end)
+                            cached.type = run_fuse(next, cached.type,
+                                                   cached.next);
+                    }
+                    object_p nnext = cached.next;
                     Returns[0] = nnext;
                     if (nnext >= end)
                     {
@@ -547,7 +807,13 @@ struct runtime
                     }
                     return next;
                 }
+
+                // Locals frame is right below the marker for its end
+                Returns += 2;
+                if ((HighMem - Returns) % CALLS_BLOCK == 0)
+                    call_stack_drop();
                 unlocals(size_t(end) - 1);
+                continue;
             }
 
             Returns += 2;
@@ -575,6 +841,56 @@ struct runtime
         return nullptr;
     }
 
+    object_p run_frame(size_t index)
+    // ------------------------------------------------------------------------
+    //   Return an entry on the return stack, counting from the top
+    // ------------------------------------------------------------------------
+    {
+        if (Returns + index < HighMem)
+            return Returns[index];
+        return nullptr;
+    }
+
+
+    template <typename Visit>
+    bool run_calls(Visit visit)
+    // ------------------------------------------------------------------------
+    //   Visit the (next, end) entries of the return stack, from the top
+    // ------------------------------------------------------------------------
+    //   Frames of locals are skipped, as well as markers with a null next.
+    //   Stops and returns true as soon as visit(next, end) returns true.
+    {
+        object_p *frame = LocalFrames;
+        for (object_p *p = Returns; p < HighMem; p += 2)
+        {
+            if (p == frame)
+            {
+                size_t count = size_t(p[1]);
+                frame = (object_p *) p[0];
+                p += (count + 1) & ~size_t(1);
+            }
+            else if (p[0] && visit(p[0], p[1] + 1))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+
+    void run_drop()
+    // ------------------------------------------------------------------------
+    //   Drop the top entry of the return stack
+    // ------------------------------------------------------------------------
+    {
+        if (Returns < HighMem)
+        {
+            Returns += 2;
+            if ((HighMem - Returns) % CALLS_BLOCK == 0)
+                call_stack_drop();
+        }
+    }
+
 
     bool run_conditionals(object_p trueC, object_p falseC, bool xeq = false);
     // ------------------------------------------------------------------------
@@ -725,10 +1041,10 @@ struct runtime
 
     size_t saved() const
     // ------------------------------------------------------------------------
-    //   Return the size of the stack save area
+    //   Return the depth of the stack that undo would restore
     // ------------------------------------------------------------------------
     {
-        return Locals - Undo;
+        return UndoDepth;
     }
 
     bool undo();
@@ -736,6 +1052,22 @@ struct runtime
     //   Undo and return earlier stack
     // ------------------------------------------------------------------------
 
+protected:
+    bool journal(size_t keep)
+    // ------------------------------------------------------------------------
+    //   Record stack levels above the bottom 'keep' before they change
+    // ------------------------------------------------------------------------
+    {
+        return keep >= UndoBase || journal_levels(keep);
+    }
+
+    bool journal_levels(size_t keep);
+    // ------------------------------------------------------------------------
+    //   Copy levels from 'keep' to UndoBase into the undo journal
+    // ------------------------------------------------------------------------
+
+public:
+
 
 
     // ========================================================================
@@ -769,9 +1101,22 @@ struct runtime
     //   Return the number of locals
     // ------------------------------------------------------------------------
     {
-        return Directories - Locals;
+        return LocalCount;
     }
 
+protected:
+    object_p *local_slot(uint index);
+    // ------------------------------------------------------------------------
+    //   Find the return stack entry holding a local
+    // ------------------------------------------------------------------------
+
+    void drop_frame(size_t entries);
+    // ------------------------------------------------------------------------
+    //   Drop a frame at the top of the return stack
+    // ------------------------------------------------------------------------
+
+public:
+
 
 
     // ========================================================================
@@ -952,21 +1297,39 @@ protected:
     object_p  ErrorCommand; // Source of the error if known
     object_p  LowMem;       // Bottom of available memory
     object_p  Globals;      // End of global objects
+    size_t    Slack;        // Free space reserved after global objects
     object_p  Temporaries;  // Temporaries (must be valid objects)
+    object_p  Nursery;      // Temporaries allocated since last collection
     size_t    Editing;      // Text editor (utf8 encoded)
     size_t    Scratch;      // Scratch pad (may be invalid objects)
     object_p *Stack;        // Top of user stack
     object_p *Args;         // Start of save area for last arguments
-    object_p *Undo;         // Start of undo stack
-    object_p *Locals;       // Start of locals
+    object_p *Undo;         // Start of undo journal
     object_p *Directories;  // Start of directories
     object_p *CallStack;    // Start of call stack (rounded 16 entries)
-    object_p *Returns;      // Start of return stack, end of locals
+    object_p *Returns;      // Start of return stack
     object_p *HighMem;      // End of available memory
+    object_p *LocalFrames;  // Innermost frame of locals, in return stack
+    size_t    LocalCount;   // Number of locals in all frames
+    size_t    UndoDepth;    // Stack depth at last save()
+    size_t    UndoBase;     // Bottom stack levels unchanged since last save()
     bool      SaveArgs;     // Save arguents (LastArgs)
 
     // Pointers that are GC-adjusted
     static gcptr *GCSafe;
+    static uint   GCSafeCount;  // Number of live GC-safe pointers
+    static uint   GCSafePeak;   // Highest number of live GC-safe pointers
+
+    // Decoded objects being run, invalidated when objects move
+    static run_entry RunCache[RUN_CACHE];
+    static uint      GlobalsGeneration;
+    static uint      DirectoriesGeneration;
+
+    // Garbage collection and allocation statistics
+    static gcstats GCStatistics;
+#if CONFIG_GC_ALLOCATIONS
+    static uint    GCAllocated[];       // Bytes allocated for each type
+#endif // CONFIG_GC_ALLOCATIONS
 };
 
 template<typename T>
@@ -1035,6 +1398,7 @@ const Obj *runtime::make(typename Obj::id type, const
         return nullptr;    // Failed to allocate
     Obj *result = (Obj *) Temporaries;
     Temporaries = (object *) ((byte *) Temporaries + size);
+    gc_allocated(type, size);
 
     // Move the editor up (available() checked we have room)
     move(Temporaries, (object_p) result, Editing + Scratch, 1, true);
@@ -604,6 +604,8 @@ cstring setting::label(object::id ty)
         return printf("MLEd %u", s.MultilineEditorFont());
     case ID_CursorBlinkRate:
         return printf("Blink %u", s.CursorBlinkRate());
+    case ID_PollingInterval:
+        return printf("Poll %u", s.PollingInterval());
     case ID_MaxNumberBits:
         return printf("Bits %u", s.MaxNumberBits());
     case ID_MaxRewrites:
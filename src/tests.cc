@@ -579,6 +579,13 @@ void tests::data_types()
     test(CLEAR, "'ABC*3' typename", ENTER)
         .type(object::ID_text)
         .expect("\"expression\"");
+
+    step("Objects with various initials on one command line");
+    test(CLEAR,
+         "\"Hi\" { 1 } [ 2 ] « 3 » 'X+1' :T:4 #12h ABC 1.5 @ Note\n"
+         "→ A « A » DEPTH", ENTER)
+        .type(object::ID_integer)
+        .expect("9");
 }
 
 
@@ -796,6 +803,15 @@ void tests::stack_operations()
         .test(BSP).expect("1")
         .test(BSP).noerror()
         .test(BSP).error("Too few arguments");
+    step("Undo after changing several levels")
+        .test(CLEAR, "10 20 30 40", ENTER).expect("40")
+        .test("Drop2 Swap 7 +", ENTER).expect("17")
+        .test(RSHIFT, M).expect("40")
+        .test(BSP).expect("30")
+        .test(BSP).expect("20")
+        .test(BSP).expect("10")
+        .test(BSP).noerror()
+        .test(BSP).error("Too few arguments");
     step("LastX")
         .test(CLEAR, "1 2").shifts(false, false, false, false)
         .test(ADD).expect("3")
@@ -807,6 +823,39 @@ void tests::stack_operations()
         .test(CLEAR, "1 2 3 4", ENTER)
         .test(RSHIFT, F3).noerror()
         .test(BSP).error("Too few arguments");
+    step("Frequent pairs in programs")
+        .test(CLEAR, "« DUP * SWAP DROP OVER OVER 1 + 1 - 0 == »", ENTER)
+        .type(object::ID_program)
+        .expect("« Duplicate × Swap Drop Over Over 1 + 1 - 0 == »")
+        .test(CLEAR, "2 3 « DUP * SWAP DROP »", ENTER, RUNSTOP)
+        .expect("9")
+        .test(CLEAR, "2 3 « OVER OVER 1 + »", ENTER, RUNSTOP)
+        .expect("4")
+        .test(BSP).expect("2")
+        .test(CLEAR, "7 « 1 - 0 == »", ENTER, RUNSTOP)
+        .expect("False")
+        .test(CLEAR, "« SWAP DROP »", ENTER, RUNSTOP)
+        .error("Too few arguments")
+        .test(CLEAR, "« DUP * SWAP DROP 1 + » SIZE", ENTER)
+        .expect("6")
+        .test(CLEAR, "« 1 + » 1 GET", ENTER)
+        .expect("1");
+
+    step("Dispatches saved by fusion in NQueens")
+        .test(CLEAR, "« → l « 0 1 l SIZE FOR i l i GET 2 GET + NEXT » » "
+              "'Dispatches' STO", ENTER).noerror();
+    cstring nqueens =
+        "« 0 DO 8 SWAP 1 + WHILE DUP2 DO 1 - UNTIL "
+        "DUP2 5 + PICK - ABS DUP2 - × NOT END REPEAT DROP "
+        "WHILE SWAP DUP 1 SAME REPEAT - END 1 - SWAP END DROP "
+        "UNTIL DUP 8 SAME END →LIST » ";
+    test(CLEAR, "NoCommandFusion", ENTER,
+         nqueens, "Profile Dispatches", ENTER,
+         "CommandFusion", ENTER,
+         nqueens, "Profile Dispatches -", ENTER)
+        .expect("3427");
+    test(CLEAR, "'Dispatches' Purge", ENTER).noerror();
+
 }
 
 
@@ -1035,6 +1084,16 @@ void tests::global_variables()
         .error("Undefined name")
         .clear();
 
+    step("Global references in programs see updated values");
+    test(CLEAR, "12 'CachedVar' STO "
+         "« CachedVar 1 + » 'CachedPgm' STO", ENTER).noerror();
+    test(CLEAR, "CachedPgm", ENTER).expect("13");
+    test(CLEAR, "14 'CachedVar' STO CachedPgm", ENTER).expect("15");
+    test(CLEAR, "'CachedVar' PURGE CachedPgm", ENTER)
+        .expect("'CachedVar+1'");
+    test(CLEAR, "2 'CachedVar' STO CachedPgm", ENTER).expect("3");
+    test(CLEAR, "'CachedVar' PURGE 'CachedPgm' PURGE", ENTER).noerror();
+
     step("Store and recall invalid variable object");
     test(CLEAR, 5678, ENTER, 1234, ENTER,
          "STO", ENTER).error("Invalid name").clear();
@@ -1100,6 +1159,19 @@ void tests::global_variables()
         .error("Undefined name")
         .clear();
 
+    step("Grow global variable in a loop");
+    test(CLEAR, "\"Above\" 'GrowAbove' STO { } 'GrowList' STO "
+         "1 50 for i GrowList i + 'GrowList' STO next", ENTER).noerror();
+    test(CLEAR, "GrowList size", ENTER).expect("50");
+    test(CLEAR, "GrowList 50 get", ENTER).expect("50");
+    test(CLEAR, "GrowAbove", ENTER).expect("\"Above\"");
+    test(CLEAR, "'GrowList' purge 'GrowAbove' purge", ENTER).noerror();
+
+    step("Garbage collection statistics");
+    test(CLEAR, "GCStatsReset GCStats SIZE", ENTER).expect("8");
+    test(CLEAR, "GCStatsReset GarbageCollect DROP GCStats 1 GET", ENTER)
+        .type(object::ID_tag).expect("Collections:1");
+
     step("Go to top-level")
         .test(CLEAR, "Home", ENTER).noerror();
     step("Clear 'DirTest'")
@@ -1138,6 +1210,29 @@ void tests::global_variables()
         .test(CLEAR, "DirTest2 Foo", ENTER).expect("\"Hello\"");
     step("Cleanup")
         .test(CLEAR, "'Foo' Purge", ENTER).noerror();
+    step("Lookups in a directory with many variables")
+        .test(CLEAR,
+              "1 'V1' STO 2 'V2' STO 3 'V3' STO 4 'V4' STO "
+              "5 'V5' STO 6 'V6' STO 7 'V7' STO 8 'V8' STO "
+              "9 'V9' STO 10 'V10' STO 11 'V11' STO 12 'V12' STO "
+              "13 'V13' STO 14 'V14' STO 15 'V15' STO 16 'V16' STO "
+              "17 'V17' STO 18 'V18' STO 19 'V19' STO 20 'V20' STO "
+              "21 'V21' STO 22 'V22' STO 23 'V23' STO 24 'V24' STO", ENTER)
+        .noerror()
+        .test(CLEAR, "V1 V24 + v12 +", ENTER).expect("37")
+        .test(CLEAR, "99 'v7' STO V7", ENTER).expect("99")
+        .test(CLEAR, "'V7' Purge V7", ENTER).expect("'V7'")
+        .test(CLEAR, "V6 V8 +", ENTER).expect("14")
+        .test(CLEAR, "4 'V7' STO V7 V24 +", ENTER).expect("28");
+    step("Cleanup many variables")
+        .test(CLEAR,
+              "'V1' Purge 'V2' Purge 'V3' Purge 'V4' Purge "
+              "'V5' Purge 'V6' Purge 'V7' Purge 'V8' Purge "
+              "'V9' Purge 'V10' Purge 'V11' Purge 'V12' Purge "
+              "'V13' Purge 'V14' Purge 'V15' Purge 'V16' Purge "
+              "'V17' Purge 'V18' Purge 'V19' Purge 'V20' Purge "
+              "'V21' Purge 'V22' Purge 'V23' Purge 'V24' Purge", ENTER)
+        .noerror();
 
     step("Save to file as text")
         .test(CLEAR, "1.42 \"Hello.txt\"", NOSHIFT, G).noerror();
@@ -1151,6 +1246,51 @@ void tests::global_variables()
         .test(CLEAR, "1.42 \"Hello.48b\"", NOSHIFT, G).noerror();
     step("Restore from file as text")
         .test(CLEAR, "\"Hello.48b\" RCL", ENTER).noerror().expect("1.42");
+    step("Save large object to file as binary")
+        .test(CLEAR, "{ } 1 600 for i i + next \"Large.48b\"", NOSHIFT, G)
+        .noerror();
+    step("Restore large object from binary file")
+        .test(CLEAR, "\"Large.48b\" RCL size", ENTER).noerror().expect("600");
+    step("Write state file with digraphs and a NUL")
+        .test(CLEAR,
+              "{ 60 60 32 45 62 32 88 32 60 60 32 88 32 88 32 42 32 "
+              "62 62 32 62 62 } Chr "
+              "\" 'DiSq' STO\" + { 10 0 } Chr + \"1 'DiSq' STO\" + "
+              "\"Digraphs.txt\" STO", ENTER).noerror();
+    step("Merge state file, converting digraphs and stopping at NUL")
+        .test(CLEAR, "\"Digraphs.txt\" MergeState", ENTER).noerror()
+        .test(CLEAR, "7 DiSq", ENTER).expect("49")
+        .test(CLEAR, "'DiSq' PURGE", ENTER).noerror();
+    step("Merge state file stops at incremental changes")
+        .test(CLEAR,
+              "\"42 'Kept' STO\" 10 Chr + "
+              "\"@ Changes since last save\" + 10 Chr + "
+              "\"'Kept' Purge\" + 10 Chr + "
+              "\"Journal.txt\" STO", ENTER).noerror()
+        .test(CLEAR, "17 \"Journal.txt\" MergeState", ENTER).noerror()
+        .test(CLEAR, "Kept", ENTER).expect("42")
+        .test(CLEAR, "'Kept' PURGE", ENTER).noerror();
+    step("Merge state file into an empty state applies changes")
+        .test(CLEAR, "\"Journal.txt\" MergeState", ENTER).noerror()
+        .test(CLEAR, "Kept", ENTER).expect("'Kept'");
+    step("Saving state again only appends changed variables")
+        .test(CLEAR,
+              "« \"x\" 1 14 START DUP + NEXT 'SavedBig' STO "
+              "1 'SavedA' STO 2 'SavedB' STO "
+              "\"Saved.txt\" SaveStateAs \"Saved.txt\" RCL SIZE → a « "
+              "3 'SavedB' STO "
+              "\"Saved.txt\" SaveStateAs \"Saved.txt\" RCL SIZE → b « "
+              "4 'SavedA' STO 5 'SavedB' STO "
+              "\"Saved.txt\" SaveStateAs \"Saved.txt\" RCL SIZE → c « "
+              "c b - b a - - » » » »", ENTER, RUNSTOP)
+        .expect("16")
+        .test(CLEAR, "'SavedA' PURGE 'SavedB' PURGE 'SavedBig' PURGE", ENTER)
+        .noerror();
+    step("Remove files written by the tests")
+        .test(CLEAR,
+              "\"Hello.txt\" PURGE \"Hello.48s\" PURGE \"Hello.48b\" PURGE "
+              "\"Large.48b\" PURGE \"Digraphs.txt\" PURGE "
+              "\"Journal.txt\" PURGE \"Saved.txt\" PURGE", ENTER).noerror();
 }
 
 
@@ -1177,6 +1317,42 @@ void tests::local_variables()
          "LocTest", ENTER)
         .expect("'(X+Y)·(X-Y)÷((Y+Z)·(Y-Z))'");
 
+    step("Memoized program with locals");
+    test(CLEAR, "MemoFlush "
+         "« Memoize → N « "
+         "IF N 2 < THEN N ELSE N 1 - MemoFib N 2 - MemoFib + END » » "
+         "'MemoFib' STO", ENTER).noerror();
+    test(CLEAR, "30 MemoFib", ENTER).expect("832040");
+    test(CLEAR, "30 MemoFib MemoStats 1 GET 0 >", ENTER).expect("True");
+    test(BSP).expect("832040");
+    test(CLEAR, "MemoFlush MemoStats", ENTER).expect("{ 0 0 }");
+    test(CLEAR, "'MemoFib' Purge", ENTER).noerror();
+
+    step("Memoized program returning two values is not cached");
+    test(CLEAR, "« Memoize → N « N N » » 'MemoTwo' STO", ENTER).noerror();
+    test(CLEAR, "3 MemoTwo 3 MemoTwo DEPTH", ENTER).expect("4");
+    test(CLEAR, "MemoStats 1 GET", ENTER).expect("0");
+    test(CLEAR, "MemoFlush 'MemoTwo' Purge", ENTER).noerror();
+
+    step("Memoized program replaced by another one");
+    test(CLEAR, "« Memoize → N « N 1 + » » 'MemoInc' STO "
+         "3 MemoInc", ENTER).expect("4");
+    test(CLEAR, "« Memoize → N « N 2 + » » 'MemoInc' STO "
+         "3 MemoInc", ENTER).expect("5");
+    test(CLEAR, "MemoFlush 'MemoInc' Purge", ENTER).noerror();
+
+    step("Nested local blocks");
+    test(CLEAR, "1 2 3 « → A B C « A B C → X Y « X Y C + + » » »", ENTER,
+         RUNSTOP).expect("8");
+    test(BSP).expect("1");
+
+    step("Recursive program with locals");
+    test(CLEAR, "« → N « IF N 0 > THEN N 1 - LocRec N + ELSE 0 END » » "
+         "'LocRec' STO", ENTER).noerror();
+    test(CLEAR, "1 2 3 100 LocRec", ENTER).expect("5050");
+    test(BSP).expect("3");
+    test(CLEAR, "'LocRec' Purge", ENTER).noerror();
+
     step("Cleanup");
     test(CLEAR, XEQ, "LocTest", ENTER, "PurgeAll", ENTER).noerror();
 }
@@ -1222,6 +1398,26 @@ void tests::for_loops()
     test(CLEAR, pgm, ENTER).noerror().type(object::ID_program).want(pgmo);
     test(RUNSTOP).noerror().type(object::ID_integer).expect(385);
 
+    step("Crossing preallocated small integers");
+    pgm  = "« 0 -20 260 FOR i 1 + NEXT »";
+    pgmo = "« 0 -20 260 for i 1 + next »";
+    test(CLEAR, pgm, ENTER).noerror().type(object::ID_program).want(pgmo);
+    test(RUNSTOP).noerror().type(object::ID_integer).expect(281);
+    test(CLEAR, "-17 1 + 256 1 + -", ENTER)
+        .noerror().type(object::ID_neg_integer).expect(-273);
+
+    step("Integer step crossing zero");
+    pgm  = "« 0 5 -5 FOR i i SQ + -2 STEP »";
+    pgmo = "« 0 5 -5 for i i x² + -2 step »";
+    test(CLEAR, pgm, ENTER).noerror().type(object::ID_program).want(pgmo);
+    test(RUNSTOP).noerror().type(object::ID_integer).expect(70);
+
+    step("Integer counter with decimal limit");
+    pgm  = "« 0 1 2.5 FOR i i + NEXT »";
+    pgmo = "« 0 1 2.5 for i i + next »";
+    test(CLEAR, pgm, ENTER).noerror().type(object::ID_program).want(pgmo);
+    test(RUNSTOP).noerror().type(object::ID_integer).expect(3);
+
     step("Negative stepping algebraic");
     pgm  = "« 'X' 10 1 FOR i i SQ + -1 step »";
     pgmo = "« 'X' 10 1 for i i x² + -1 step »";
@@ -1335,6 +1531,30 @@ void tests::conditionals()
         .expect("#0₁₆")
         .test(BSP)
         .expect("\"\"");
+
+    step("Profiling a program")
+        .test(CLEAR, "0 « 1 10 START 1 + NEXT » Profile", ENTER)
+        .type(object::ID_list)
+        .test(BSP).expect("10");
+
+    step("Optimizing a program")
+        .test(CLEAR, "« 2 3 * X + » Optimize", ENTER)
+        .type(object::ID_program)
+        .expect("« 6 X + »")
+        .test(CLEAR, "« 2 1 + X 1 + »", ENTER, "Optimize", ENTER)
+        .expect("« 3 X 1 + »")
+        .test(CLEAR, "« 2 IF 1 2 < THEN 3 * ELSE A END »", ENTER,
+              "Optimize", ENTER)
+        .expect("« 6 »")
+        .test(CLEAR, "« IF 0 THEN A END WHILE 0 REPEAT B END C »", ENTER,
+              "Optimize", ENTER)
+        .expect("« C »")
+        .test(CLEAR, "« 1 0 / »", ENTER, "Optimize", ENTER)
+        .expect("« 1 0 ÷ »")
+        .test(CLEAR, "1 « IF DUP THEN 1 2 + END » Optimize Eval", ENTER)
+        .expect("3")
+        .test(CLEAR, "5 Optimize", ENTER)
+        .error("Bad argument type");
 }
 
 
@@ -1112,6 +1112,34 @@ unit_p unit::custom_cycle(symbol_r sym) const
 }
 
 
+struct unit_chars
+// ----------------------------------------------------------------------------
+//   Buffer characters read from a unit file to append them in chunks
+// ----------------------------------------------------------------------------
+{
+    unit_chars(): count(0) {}
+
+    bool add(byte c)
+    {
+        if (count >= sizeof(data) && !flush())
+            return false;
+        data[count++] = c;
+        return true;
+    }
+
+    bool flush()
+    {
+        if (count && !rt.append(count, gcbytes(data)))
+            return false;
+        count = 0;
+        return true;
+    }
+
+    byte        data[32];
+    size_t      count;
+};
+
+
 symbol_g unit_file::lookup(gcutf8 what, size_t len, bool menu, bool seek0)
 // ----------------------------------------------------------------------------
 //   Find the next row that begins with "what", return definition for it
@@ -1124,6 +1152,7 @@ symbol_g unit_file::lookup(gcutf8 what, size_t len, bool menu, bool seek0)
     size_t   matching = 0;
     symbol_g def      = nullptr;
     scribble scr;
+    unit_chars chars;
 
     def = nullptr;
     if (seek0)
@@ -1139,11 +1168,8 @@ symbol_g unit_file::lookup(gcutf8 what, size_t len, bool menu, bool seek0)
             if (quoted && peek() == '"') // Treat double "" as a data quote
             {
                 c = getchar();
-                if (column == 1 && found)
-                {
-                    byte *buf = rt.allocate(1);
-                    *buf = byte(c);
-                }
+                if (column == 1 && found && !chars.add(c))
+                    return nullptr;
             }
             else
             {
@@ -1169,6 +1195,8 @@ symbol_g unit_file::lookup(gcutf8 what, size_t len, bool menu, bool seek0)
                     }
                     else if (column == 1 && !menu)
                     {
+                        if (!chars.flush())
+                            return nullptr;
                         def = symbol::make(scr.scratch(), scr.growth());
                         scr.clear();
                     }
@@ -1189,10 +1217,9 @@ symbol_g unit_file::lookup(gcutf8 what, size_t len, bool menu, bool seek0)
             {
                 found = found && matching < len && c == (+what)[matching++];
             }
-            else if (column == 1 && found)
+            else if (column == 1 && found && !chars.add(c))
             {
-                byte *buf = rt.allocate(1);
-                *buf = byte(c);
+                return nullptr;
             }
         }
     }
@@ -1210,6 +1237,7 @@ symbol_g unit_file::next(bool menu)
     bool     quoted   = false;
     symbol_g sym      = nullptr;
     scribble scr;
+    unit_chars chars;
 
     while (valid())
     {
@@ -1226,6 +1254,8 @@ symbol_g unit_file::next(bool menu)
         else if (c == '\n')
         {
             // We had a full record, exit if we found our entry
+            if (!chars.flush())
+                return nullptr;
             if (column)
             {
                 if (menu == (column == 1))
@@ -1241,11 +1271,8 @@ symbol_g unit_file::next(bool menu)
         }
         else if (quoted)
         {
-            if (column == 0)
-            {
-                byte *buf = rt.allocate(1);
-                *buf = byte(c);
-            }
+            if (column == 0 && !chars.add(c))
+                return nullptr;
         }
     }
     return sym;
@@ -39,6 +39,7 @@
 #include "locals.h"
 #include "parser.h"
 #include "renderer.h"
+#include "tag.h"
 
 
 RECORDER(directory,       16, "Directories");
@@ -235,6 +236,8 @@ bool directory::store(object_g name, object_g value)
 
         // Copy new value into storage location
         memmove((byte *) evalue, (byte *) value, vs);
+        if (vs == es)
+            rt.directories_changed();   // Contents changed, but did not move
 
         // Compute change in size for directories
         delta = vs - es;
@@ -325,6 +328,188 @@ void directory::adjust_sizes(directory_r thisdir, int delta)
 }
 
 
+// ============================================================================
+//
+//   Hashed index for large directories
+//
+// ============================================================================
+//   For large directories, lookup() uses an open-addressing hash table that
+//   maps case-folded names to the offset of the entry in the directory.
+//   The table is built on demand as a text in temporaries, which is kept
+//   alive by a GC-safe pointer. Only directories in the global area are
+//   indexed. They only move or change when the directories generation
+//   changes, which garbage collection does not do. Indexes are dropped
+//   when memory runs low or the runtime is reset, and they never appear
+//   in the saved state. If memory is low, lookup() uses a linear scan.
+
+struct directory_index
+// ----------------------------------------------------------------------------
+//   An index for a directory
+// ----------------------------------------------------------------------------
+{
+    directory_p directory;      // Directory being indexed
+    text_g      slots;          // Offset+1 of entries (4 bytes), 0 if empty
+    uint        mask;           // Number of slots minus one
+    uint        generation;     // Directories generation when built
+};
+
+enum { INDEX_MIN = 16, INDEX_CACHE = 4 };
+static uint DirectoryIndexNext = 0;
+
+
+static directory_index *directory_indexes()
+// ----------------------------------------------------------------------------
+//   Return the index cache, constructed on first use
+// ----------------------------------------------------------------------------
+{
+    static directory_index cache[INDEX_CACHE];
+    return cache;
+}
+
+
+void directory::index_flush()
+// ----------------------------------------------------------------------------
+//   Drop all directory indexes, e.g. to release memory
+// ----------------------------------------------------------------------------
+{
+    directory_index *cache = directory_indexes();
+    for (uint i = 0; i < INDEX_CACHE; i++)
+    {
+        cache[i].directory = nullptr;
+        cache[i].slots = nullptr;
+    }
+}
+
+
+static uint32_t name_hash(object_p name, size_t size)
+// ----------------------------------------------------------------------------
+//   Hash a name, ignoring ASCII case like strncasecmp does
+// ----------------------------------------------------------------------------
+{
+    byte_p   p    = byte_p(name);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++)
+    {
+        byte c = p[i];
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
+
+
+static inline uint32_t index_slot(byte_p slots, uint i)
+// ----------------------------------------------------------------------------
+//   Read an index slot (text payload is not aligned)
+// ----------------------------------------------------------------------------
+{
+    uint32_t result;
+    memcpy(&result, slots + 4 * i, sizeof(result));
+    return result;
+}
+
+
+static byte_p directory_index_find(directory_p dir, byte_p body, size_t size,
+                                   uint &mask)
+// ----------------------------------------------------------------------------
+//   Find or build an index for the given directory, nullptr for linear scan
+// ----------------------------------------------------------------------------
+{
+    // Only index directories that cannot change without a generation update
+    if (size < INDEX_MIN * 4 || !rt.in_globals(dir))
+        return nullptr;
+
+    directory_index *cache      = directory_indexes();
+    uint             generation = rt.directories_generation();
+    for (uint i = 0; i < INDEX_CACHE; i++)
+    {
+        directory_index &ix = cache[i];
+        if (ix.directory == dir && ix.generation == generation)
+        {
+            if (!ix.slots)
+                return nullptr;
+            mask = ix.mask;
+            return ix.slots->value();
+        }
+    }
+
+    // Record the attempt, so that we do not retry until next generation
+    directory_index &ix = cache[DirectoryIndexNext++ % INDEX_CACHE];
+    ix.directory = dir;
+    ix.slots = nullptr;
+    ix.mask = 0;
+    ix.generation = generation;
+
+    // Count entries
+    uint   count = 0;
+    byte_p p     = body;
+    byte_p last  = body + size;
+    while (p < last)
+    {
+        p += object_p(p)->size();
+        p += object_p(p)->size();
+        count++;
+    }
+    if (count < INDEX_MIN || p != last)
+        return nullptr;
+
+    // Check if we have room for the index without garbage collecting,
+    // since callers may hold unprotected pointers to the name
+    uint buckets = 2 * INDEX_MIN;
+    while (buckets < 2 * count)
+        buckets *= 2;
+    size_t len    = 4 * buckets;
+    size_t needed = leb128size(object::ID_text) + leb128size(len) + len;
+    if (rt.editing() || rt.allocated() || rt.available() < 4 * needed)
+        return nullptr;
+
+    // Build the index as a text object in the scratchpad
+    byte *index = rt.allocate(needed);
+    if (!index)
+        return nullptr;
+    byte *slots = leb128(index, object::ID_text);
+    slots = leb128(slots, len);
+    memset(slots, 0, len);
+
+    mask = buckets - 1;
+    for (p = body; p < last; p += object_p(p)->size())
+    {
+        object_p name = object_p(p);
+        size_t   ns   = name->size();
+        uint32_t off  = p - body + 1;
+        uint     i    = name_hash(name, ns) & mask;
+        while (index_slot(slots, i))
+            i = (i + 1) & mask;
+        memcpy(slots + 4 * i, &off, sizeof(off));
+        p += ns;
+    }
+    ix.slots = text_p(rt.temporary());
+    ix.mask = mask;
+    return slots;
+}
+
+
+static inline bool same_name(object_p name, object_p ref,
+                             size_t rsize, bool issym)
+// ----------------------------------------------------------------------------
+//   Check if a directory name matches the reference name
+// ----------------------------------------------------------------------------
+{
+    if (name == ref)          // Optimization when name is from directory
+        return true;
+    if (name->size() != rsize)
+        return false;
+
+    // Regular symbols: case insensitive comparison
+    if (issym)
+        return strncasecmp(cstring(name), cstring(ref), rsize) == 0;
+
+    // Special symbols, e.g. ΣData
+    return memcmp(cstring(name), cstring(ref), rsize) == 0;
+}
+
+
 object_p directory::lookup(object_p ref) const
 // ----------------------------------------------------------------------------
 //   Find if the name exists in the directory, if so return pointer to it
@@ -335,27 +520,27 @@ object_p directory::lookup(object_p ref) const
     size_t rsize = ref->size();
     bool   issym = ref->type() == ID_symbol;
 
+    // Use the hashed index if there is one
+    uint mask = 0;
+    if (byte_p slots = directory_index_find(this, p, size, mask))
+    {
+        for (uint i = name_hash(ref, rsize) & mask; ; i = (i + 1) & mask)
+        {
+            uint32_t off = index_slot(slots, i);
+            if (!off)
+                return nullptr;
+            object_p name = object_p(p + off - 1);
+            if (same_name(name, ref, rsize, issym))
+                return name;
+        }
+    }
+
     while (size)
     {
         object_p name = (object_p) p;
         size_t ns = name->size();
-        if (name == ref)          // Optimization when name is from directory
+        if (same_name(name, ref, rsize, issym))
             return name;
-        if (ns == rsize)
-        {
-            if (issym)
-            {
-                // Regular symbols: case insensitive comparison
-                if (strncasecmp(cstring(name), cstring(ref), rsize) == 0)
-                    return name;
-            }
-            else
-            {
-                // Special symbols, e.g. ΣData
-                if (memcmp(cstring(name), cstring(ref), rsize) == 0)
-                    return name;
-            }
-        }
 
         p += ns;
         object_p value = (object_p) p;
@@ -390,6 +575,30 @@ object_p directory::recall(object_p ref) const
 }
 
 
+// ============================================================================
+//
+//   Cache for global name lookups
+//
+// ============================================================================
+//   Names in programs are looked up each time the program runs.
+//   The cache remembers where a name was found (or that it was not found),
+//   keyed by the address of the name object. It is invalidated by the
+//   runtime whenever globals move or the current directory changes.
+
+struct name_cache
+// ----------------------------------------------------------------------------
+//   A cached name lookup
+// ----------------------------------------------------------------------------
+{
+    object_p    name;
+    object_p    value;
+    uint        generation;
+};
+
+enum { NAME_CACHE = 32 };
+static name_cache NameCache[NAME_CACHE] = { };
+
+
 object_p directory::recall_all(object_p name, bool report_missing)
 // ----------------------------------------------------------------------------
 //   If the referenced object exists in directory, return associated value
@@ -453,13 +662,30 @@ object_p directory::recall_all(object_p name, bool report_missing)
         return nullptr;
     }
 
-    directory *dir = nullptr;
-    for (uint depth = 0; (dir = rt.variables(depth)); depth++)
-        if (object_p value = dir->recall(name))
-            return value;
-    if (report_missing)
+    // Check if we already looked up this name since globals last changed
+    uint        generation = rt.globals_generation();
+    bool        cacheable  = !rt.in_scratch(name);
+    name_cache &cache      = NameCache[(uintptr_t(name) >> 1) % NAME_CACHE];
+    if (cacheable && cache.name == name && cache.generation == generation)
+    {
+        if (!cache.value && report_missing)
+            rt.undefined_name_error();
+        return cache.value;
+    }
+
+    object_p    result = nullptr;
+    directory  *dir    = nullptr;
+    for (uint depth = 0; !result && (dir = rt.variables(depth)); depth++)
+        result = dir->recall(name);
+    if (cacheable)
+    {
+        cache.name       = name;
+        cache.value      = result;
+        cache.generation = generation;
+    }
+    if (!result && report_missing)
         rt.undefined_name_error();
-    return nullptr;
+    return result;
 }
 
 
@@ -801,14 +1027,86 @@ COMMAND_BODY(GarbageCollect)
 }
 
 
+static bool gc_statistic(cstring label, size_t value)
+// ----------------------------------------------------------------------------
+//   Append a tagged integer value to the scratchpad
+// ----------------------------------------------------------------------------
+{
+    integer_g num = integer::make(value);
+    tag_g     tagged = num ? tag::make(label, +num) : nullptr;
+    return tagged && rt.append(tagged->size(), byte_p(+tagged));
+}
+
+
+static list_p gc_allocations()
+// ----------------------------------------------------------------------------
+//   Build a list with the bytes allocated for each object type
+// ----------------------------------------------------------------------------
+{
+    scribble scr;
+    for (uint type = 0; type < object::NUM_IDS; type++)
+        if (uint bytes = rt.gc_allocations(type))
+            if (!gc_statistic(cstring(object::name(object::id(type))), bytes))
+                return nullptr;
+    return list::make(object::ID_list, scr.scratch(), scr.growth());
+}
+
+
+COMMAND_BODY(GCStats)
+// ----------------------------------------------------------------------------
+//   Return garbage collection and allocation statistics
+// ----------------------------------------------------------------------------
+{
+    if (!rt.args(0))
+        return ERROR;
+
+    const runtime::gcstats &stats = rt.gc_statistics();
+    scribble scr;
+    if (gc_statistic("Collections", stats.collections) &&
+        gc_statistic("Minor",       stats.minor)       &&
+        gc_statistic("Recycled",    stats.recycled)    &&
+        gc_statistic("Moved",       stats.moved)       &&
+        gc_statistic("Fixups",      stats.fixups)      &&
+        gc_statistic("Pause",       stats.pause)       &&
+        gc_statistic("GCSafe",      rt.gc_safe_peak()))
+    {
+        if (list_g allocs = gc_allocations())
+        {
+            tag_g tagged = tag::make("Allocated", +allocs);
+            if (tagged && rt.append(tagged->size(), byte_p(+tagged)))
+            {
+                list_p result = list::make(scr.scratch(), scr.growth());
+                if (result && rt.push(result))
+                    return OK;
+            }
+        }
+    }
+    return ERROR;
+}
+
+
+COMMAND_BODY(GCStatsReset)
+// ----------------------------------------------------------------------------
+//   Reset garbage collection and allocation statistics
+// ----------------------------------------------------------------------------
+{
+    if (!rt.args(0))
+        return ERROR;
+    rt.gc_reset_statistics();
+    return OK;
+}
+
+
 COMMAND_BODY(FreeMemory)
 // ----------------------------------------------------------------------------
 //   Return amount of free memory (available without garbage collection)
 // ----------------------------------------------------------------------------
+//   This includes the slack reserved after global variables, which is
+//   released for temporaries when we run out of memory
 {
     if (rt.args(0))
     {
-        size_t available = rt.available();
+        size_t available = rt.available() + rt.slack();
         integer_p result = rt.make<integer>(ID_integer, available);
         if (rt.push(result))
             return OK;
@@ -121,6 +121,11 @@ struct directory : list
     //   Purge an entry from the directory and parents
     // ------------------------------------------------------------------------
 
+    static void index_flush();
+    // ------------------------------------------------------------------------
+    //   Drop the name indexes of large directories
+    // ------------------------------------------------------------------------
+
     size_t count() const
     // ------------------------------------------------------------------------
     //   Return the number of variables in the directory
@@ -190,6 +195,8 @@ COMMAND_DECLARE(Mem);
 COMMAND_DECLARE(FreeMemory);
 COMMAND_DECLARE(SystemMemory);
 COMMAND_DECLARE(GarbageCollect);
+COMMAND_DECLARE(GCStats);
+COMMAND_DECLARE(GCStatsReset);
 
 COMMAND_DECLARE(home);             // Return to home directory
 COMMAND_DECLARE(CurrentDirectory); // Return the current directory object